@@ -0,0 +1,59 @@
+#!/bin/sh
+# Times the threaded cores and the JIT on a loop of two chunks that always go
+# on to each other through the top of the stack, built with and without
+# XRF_SUCCESSOR_CACHE. The loop reads a character and goes to chunk 65 with
+# it, which drops it and goes back, until the input runs out. Each run is
+# timed the given number of times, 5 by default, and the best time is shown
+#
+# Usage: bench/successor_cache.sh [runs]
+
+cd "$(dirname "$0")/.." || exit 1
+runs=${1:-5}
+
+work=$(mktemp -d) || exit 1
+trap 'rm -rf "$work"' EXIT
+
+SOURCES="xrf.c jit.c emit_c.c output.c input.c scan.c stream.c image.c
+         native.c supergen.c super.c ir.c"
+gcc $SOURCES -o "$work/plain" -O3 -pthread -ldl || exit 1
+gcc $SOURCES -o "$work/cached" -O3 -pthread -ldl -DXRF_SUCCESSOR_CACHE \
+    || exit 1
+
+# Chunk 0 starts the loop at chunk 3 and ends the program once it's gone
+# back to on the end of the input, and every other chunk is filler
+{
+    printf '8B555\n'
+    i=1
+    while [ $i -lt 66 ]; do
+        case $i in
+            3) printf '0AFFF\n' ;;
+            65) printf '2AFFF\n' ;;
+            *) printf 'FFFFF\n' ;;
+        esac
+        i=$((i + 1))
+    done
+} > "$work/loop.xrf"
+head -c 50000000 /dev/zero | tr '\0' 'A' > "$work/loop.in"
+
+# Prints the best time of the runs of a build with an engine, in seconds
+best() {
+    i=0
+    best=
+    while [ $i -lt "$runs" ]; do
+        start=$(date +%s.%N)
+        "$work/$1" --engine="$2" "$work/loop.xrf" < "$work/loop.in" \
+            || exit 1
+        end=$(date +%s.%N)
+        best=$(echo "$start $end $best" \
+               | awk '{ t = $2 - $1; if ($3 != "" && $3 < t) t = $3;
+                        printf "%.3f", t }')
+        i=$((i + 1))
+    done
+    echo "$best"
+}
+
+printf '%-6s %8s %8s\n' engine plain cached
+for engine in goto tail jit; do
+    printf '%-6s %8s %8s\n' "$engine" "$(best plain "$engine")" \
+        "$(best cached "$engine")"
+done
@@ -0,0 +1,407 @@
+#include "xrf.h"
+
+/* The runtime every translated program starts with. It mirrors the stack and
+   the commands of the interpreter, down to the error messages and the order
+   that rand is called in, so a translated program behaves exactly like the
+   interpreted one */
+const char *const C_RUNTIME[] = {
+    "#include <stdio.h>",
+    "#include <stdlib.h>",
+    "#include <time.h>",
+    "",
+    "static unsigned int *vals;",
+    "static size_t head, mask = 63, size = 1;",
+    "",
+    "#define TOP (vals[head])",
+    "#define AT(i) (vals[(head + (i)) & mask])",
+    "",
+    "static void fail(const char *msg) {",
+    "    fputs(msg, stderr);",
+    "    exit(1);",
+    "}",
+    "",
+    "static void grow(void) {",
+    "    size_t i, capacity = mask + 1;",
+    "    unsigned int *new_vals = malloc(sizeof(unsigned int) * capacity * 2);",
+    "",
+    "    if (new_vals == NULL)",
+    "        fail(\"Error! Unable to allocate additional stack space!\\n\");",
+    "    for (i = 0; i < size; i++)",
+    "        new_vals[i] = AT(i);",
+    "    free(vals);",
+    "    vals = new_vals;",
+    "    head = 0;",
+    "    mask = capacity * 2 - 1;",
+    "}",
+    "",
+    "static void push(unsigned int val) {",
+    "    if (size > mask)",
+    "        grow();",
+    "    head = (head - 1) & mask;",
+    "    TOP = val;",
+    "    size++;",
+    "}",
+    "",
+    "static unsigned int pop(void) {",
+    "    unsigned int val;",
+    "",
+    "    if (size == 0)",
+    "        fail(\"Error! Can't pop an empty stack!\\n\");",
+    "    val = TOP;",
+    "    head = (head + 1) & mask;",
+    "    size--;",
+    "    return val;",
+    "}",
+    "",
+    "static inline unsigned int read_char(void) {",
+    "    int c = getchar();",
+    "",
+    "    return c == EOF ? 0 : (unsigned) c;",
+    "}",
+    "",
+    "static inline void input(void) {",
+    "    push(read_char());",
+    "}",
+    "",
+    "static inline void output(void) {",
+    "    if (size == 0)",
+    "        fail(\"Error! Cannot output nonexistent value!\\n\");",
+    "    putchar(pop());",
+    "}",
+    "",
+    "static inline void dup(void) {",
+    "    if (size == 0)",
+    "        fail(\"Error! Nothing on the stack to be duplicated!\\n\");",
+    "    push(TOP);",
+    "}",
+    "",
+    "static inline void swap(void) {",
+    "    unsigned int temp;",
+    "",
+    "    if (size < 2) {",
+    "        fprintf(stderr, \"Error! Can't swap the top two elements on a%s \"",
+    "                        \"stack\\n\", size == 1 ? \" one-element\" : \"n empty\");",
+    "        exit(1);",
+    "    }",
+    "    temp = TOP;",
+    "    TOP = AT(1);",
+    "    AT(1) = temp;",
+    "}",
+    "",
+    "static inline void inc(void) {",
+    "    if (size == 0)",
+    "        fail(\"Error! Cannot increment nonexistent value!\\n\");",
+    "    TOP += 1;",
+    "}",
+    "",
+    "static inline void dec(void) {",
+    "    if (size == 0)",
+    "        fail(\"Error! Cannot decrement nonexistent value!\\n\");",
+    "    if (TOP > 0)",
+    "        TOP -= 1;",
+    "}",
+    "",
+    "static inline void add(void) {",
+    "    if (size < 2) {",
+    "        fprintf(stderr, \"Error! Cannot add the top values of a%s\\n\",",
+    "                size ? \" one-value stack.\" : \"n empty stack.\");",
+    "        exit(1);",
+    "    }",
+    "    AT(1) += TOP;",
+    "    pop();",
+    "}",
+    "",
+    "static inline void bottom(void) {",
+    "    unsigned int val;",
+    "",
+    "    if (size == 0)",
+    "        fail(\"Error! Can't send nonexistent value to the bottom of the \"",
+    "             \"stack!\\n\");",
+    "    if (size > 1) {",
+    "        val = TOP;",
+    "        head = (head + 1) & mask;",
+    "        AT(size - 1) = val;",
+    "    }",
+    "}",
+    "",
+    "static inline void randomize(void) {",
+    "    size_t i;",
+    "",
+    "    for (i = size > 0 ? size - 1 : 0; i > 0; i--) {",
+    "        size_t swap_index = rand() % (i + 1);",
+    "        unsigned int temp = AT(swap_index);",
+    "        AT(swap_index) = AT(i);",
+    "        AT(i) = temp;",
+    "    }",
+    "}",
+    "",
+    "static inline void sub(void) {",
+    "    unsigned int val;",
+    "",
+    "    if (size < 2) {",
+    "        fprintf(stderr, \"Error! Cannot get the difference of the top two \"",
+    "                        \"values of a%s!\\n\",",
+    "                size ? \" one-value stack\" : \"n empty stack\");",
+    "        exit(1);",
+    "    }",
+    "    val = pop();",
+    "    if (val <= TOP)",
+    "        TOP -= val;",
+    "    else",
+    "        TOP = val - TOP;",
+    "}",
+    ""
+};
+
+const size_t NUM_C_RUNTIME_LINES = sizeof(C_RUNTIME) / sizeof(*C_RUNTIME);
+
+/* The C statement that runs each op */
+const char *const C_STATEMENTS[NUM_OPS] = {
+    [OP_INPUT] = "input();",
+    [OP_OUTPUT] = "output();",
+    [OP_POP] = "pop();",
+    [OP_DUP] = "dup();",
+    [OP_SWAP] = "swap();",
+    [OP_INC] = "inc();",
+    [OP_DEC] = "dec();",
+    [OP_ADD] = "add();",
+    [OP_BOTTOM] = "bottom();",
+    [OP_EXIT] = "exit(0);",
+    [OP_RANDOMIZE] = "randomize();",
+    [OP_SUB] = "sub();"
+};
+
+/* Writes the statements that run a segment of a lifted variant, assuming
+   the stack is deep enough for it and has room for what it pushes. The
+   values are kept in locals, so only those left on the stack are stored,
+   and only if they aren't already in the right slot */
+void emit_c_segment(FILE *out, const struct IrSegment *seg) {
+    int shift = seg->consumed - seg->depth;
+    unsigned i;
+
+    fprintf(out, "    {\n");
+    for (i = 0; i < seg->num_insts; i++) {
+        const struct IrInst *inst = &seg->insts[i];
+
+        if (!inst->live) {
+            continue;
+        }
+        if (inst->op == IR_OUTPUT) {
+            fprintf(out, "        putchar(v%u);\n", inst->a);
+            continue;
+        }
+        fprintf(out, "        unsigned int v%u = ", i);
+        switch (inst->op) {
+            case IR_LOAD:
+                fprintf(out, "AT(%u);\n", inst->imm);
+                break;
+            case IR_CONST:
+                fprintf(out, "%uu;\n", inst->imm);
+                break;
+            case IR_INPUT:
+                fprintf(out, "read_char();\n");
+                break;
+            case IR_ADD:
+                fprintf(out, "v%u + v%u;\n", inst->a, inst->b);
+                break;
+            case IR_ADD_IMM:
+                fprintf(out, "v%u + %uu;\n", inst->a, inst->imm);
+                break;
+            case IR_SUB_SAT:
+                fprintf(out, "v%u > %uu ? v%u - %uu : 0;\n", inst->a,
+                        inst->imm, inst->a, inst->imm);
+                break;
+            case IR_DIFF:
+                fprintf(out, "v%u > v%u ? v%u - v%u : v%u - v%u;\n",
+                        inst->a, inst->b, inst->a, inst->b, inst->b, inst->a);
+                break;
+        }
+    }
+
+    /* The ith value from the top ends up shift + i slots down from the old
+       top */
+    for (i = 0; i < seg->depth; i++) {
+        if (!ir_in_place(seg, i)) {
+            fprintf(out, "        AT(%d) = v%u;\n", shift + (int) i,
+                    seg->stack[seg->depth - 1 - i]);
+        }
+    }
+    if (shift > 0) {
+        fprintf(out, "        head = (head + %d) & mask;\n", shift);
+        fprintf(out, "        size -= %d;\n", shift);
+    } else if (shift < 0) {
+        fprintf(out, "        head = (head - %d) & mask;\n", -shift);
+        fprintf(out, "        size += %d;\n", -shift);
+    }
+    fprintf(out, "    }\n");
+}
+
+/* The one chunk that has each unique body, or SHARED_BODY. The chunk a
+   variant always goes to next is only known outright for these */
+static size_t *sole_chunks;
+
+/* Whether any variant jumps to the bounds check of the dispatch with the
+   next chunk already worked out */
+static bool follow_used;
+
+/* Writes the jump to the next chunk that ends a variant, unless the variant
+   always exits. A variant that always goes back to its own chunk jumps
+   straight to the body's revisit code. One that always goes a fixed
+   distance ahead jumps straight to the code of that chunk if its body only
+   has one chunk, and otherwise skips reading the next chunk off the stack */
+void emit_c_exit(FILE *out, size_t unique, const struct Variant *variant) {
+    size_t next;
+
+    if (variant->exit_delta == 0) {
+        fprintf(out, "    goto body_%zu_again;\n", unique);
+    } else if (variant->len > 0
+               && variant->ops[variant->len - 1] == OP_EXIT)
+    {
+        return;
+    } else if (variant->exit_delta == EXIT_DYNAMIC) {
+        fprintf(out, "    goto next;\n");
+    } else if (sole_chunks[unique] != SHARED_BODY
+               && (next = sole_chunks[unique] + variant->exit_delta)
+                  < code.num_chunks)
+    {
+        fprintf(out, "    chunk = %zu;\n", next);
+        fprintf(out, "    if (visited[chunk])\n");
+        fprintf(out, "        goto body_%lu_again;\n",
+                (unsigned long) CHUNK_UNIQUE(code.chunks[next]));
+        fprintf(out, "    visited[chunk] = 1;\n");
+        fprintf(out, "    goto body_%lu;\n",
+                (unsigned long) CHUNK_UNIQUE(code.chunks[next]));
+    } else {
+        fprintf(out, "    chunk += %d;\n", variant->exit_delta);
+        fprintf(out, "    goto follow;\n");
+        follow_used = true;
+    }
+}
+
+/* Writes the code of one variant of a unique body, under the given label.
+   Unless the variant can't fail, its lifted and optimized segments only run
+   once a guard has made sure the stack is deep enough and has room, and the
+   statements of its ops run one at a time otherwise, reporting errors just
+   like the interpreter */
+void emit_c_variant(FILE *out, const char *label, size_t unique,
+                    const struct Variant *variant)
+{
+    struct IrVariant ir;
+    unsigned i;
+
+    fprintf(out, "%s:\n", label);
+    if (variant->len == 0) {
+        emit_c_exit(out, unique, variant);
+        return;
+    }
+    if (variant->min_depth > 0 && variant->max_growth > 0) {
+        fprintf(out, "    if (size < %u || size + %u > mask + 1)\n",
+                variant->min_depth, variant->max_growth);
+    } else if (variant->min_depth > 0) {
+        fprintf(out, "    if (size < %u)\n", variant->min_depth);
+    } else if (variant->max_growth > 0) {
+        fprintf(out, "    if (size + %u > mask + 1)\n", variant->max_growth);
+    }
+    if (variant->min_depth > 0 || variant->max_growth > 0) {
+        fprintf(out, "        goto %s_checked;\n", label);
+    }
+    lift_variant(variant, &ir);
+    for (i = 0; i < ir.num_segments; i++) {
+        emit_c_segment(out, &ir.segments[i]);
+        if (ir.segments[i].barrier != OP_END_CHUNK) {
+            fprintf(out, "    %s\n", C_STATEMENTS[ir.segments[i].barrier]);
+        }
+    }
+    emit_c_exit(out, unique, variant);
+
+    if (variant->min_depth > 0 || variant->max_growth > 0) {
+        fprintf(out, "%s_checked:\n", label);
+        for (i = 0; i < variant->len; i++) {
+            fprintf(out, "    %s\n", C_STATEMENTS[variant->ops[i]]);
+        }
+        emit_c_exit(out, unique, variant);
+    }
+}
+
+/* Writes the table of which unique body each chunk has */
+void emit_c_body_table(FILE *out) {
+    size_t i;
+
+    fprintf(out, "    static const unsigned int body[%zu] = {",
+            code.num_chunks > 0 ? code.num_chunks : 1);
+    for (i = 0; i < code.num_chunks; i++) {
+        fprintf(out, "%s%lu", i == 0 ? "\n        "
+                              : i % 12 == 0 ? ",\n        " : ", ",
+                (unsigned long) CHUNK_UNIQUE(code.chunks[i]));
+    }
+    fprintf(out, "%s\n    };\n", code.num_chunks > 0 ? "" : "\n        0");
+}
+
+void emit_c(FILE *out, const char *source_name, const char *entry) {
+    size_t i;
+
+    fprintf(out, "/* Translated from %s by xrf --emit-c */\n", source_name);
+    for (i = 0; i < NUM_C_RUNTIME_LINES; i++) {
+        fprintf(out, "%s\n", C_RUNTIME[i]);
+    }
+
+    /* Each chunk only records which unique body it has, so the code of a
+       body is written once however many chunks share it */
+    fprintf(out, "int %s(void) {\n", entry);
+    emit_c_body_table(out);
+    fprintf(out, "    static unsigned char visited[%zu];\n",
+            code.num_chunks > 0 ? code.num_chunks : 1);
+    fprintf(out, "    size_t chunk;\n\n");
+    fprintf(out, "    vals = malloc(sizeof(unsigned int) * (mask + 1));\n");
+    fprintf(out, "    if (vals == NULL)\n");
+    fprintf(out, "        fail(\"Error! Unable to allocate additional stack "
+                 "space!\\n\");\n");
+    fprintf(out, "    vals[0] = 0;\n");
+    fprintf(out, "    srand(time(NULL));\n");
+    fprintf(out, "    goto next;\n");
+
+    sole_chunks = find_sole_chunks();
+    follow_used = false;
+
+    for (i = 0; i < code.num_bodies; i++) {
+        char label[32];
+
+        snprintf(label, sizeof(label), "body_%zu", i);
+        fprintf(out, "\n");
+        emit_c_variant(out, label, i, &code.variants[i * 2]);
+        snprintf(label, sizeof(label), "body_%zu_again", i);
+        emit_c_variant(out, label, i, &code.variants[i * 2 + 1]);
+    }
+
+    /* The body of the chunk on top of the stack is picked by whether the
+       chunk has been visited yet */
+    fprintf(out, "\nnext:\n");
+    fprintf(out, "    if (size == 0)\n");
+    fprintf(out, "        fail(\"Error! Can't have an empty stack upon "
+                 "reaching the end of a chunk!\\n\");\n");
+    fprintf(out, "    chunk = TOP;\n");
+    if (follow_used) {
+        fprintf(out, "follow:\n");
+    }
+    fprintf(out, "    if (chunk >= %zu) {\n", code.num_chunks);
+    fprintf(out, "        fprintf(stderr, \"Error! Cannot go to nonexistent "
+                 "chunk %%zu!\\n\", chunk);\n");
+    fprintf(out, "        exit(1);\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "    if (visited[chunk]) {\n");
+    fprintf(out, "        switch (body[chunk]) {\n");
+    for (i = 0; i < code.num_bodies; i++) {
+        fprintf(out, "            case %zu: goto body_%zu_again;\n", i, i);
+    }
+    fprintf(out, "        }\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "    visited[chunk] = 1;\n");
+    fprintf(out, "    switch (body[chunk]) {\n");
+    for (i = 0; i < code.num_bodies; i++) {
+        fprintf(out, "        case %zu: goto body_%zu;\n", i, i);
+    }
+    fprintf(out, "    }\n");
+    fprintf(out, "    return 0;\n");
+    fprintf(out, "}\n");
+    free(sole_chunks);
+}
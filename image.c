@@ -0,0 +1,192 @@
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "xrf.h"
+
+/* Compiled programs start with this, which can't start a program's text */
+const char IMAGE_MAGIC[4] = { 'X', 'R', 'F', 'B' };
+
+/* Bumped whenever the layout of a compiled program changes */
+#define IMAGE_VERSION 3
+
+#define CHECKSUM_PRIME 0x100000001B3ULL
+
+/* The header of a compiled program. It's followed by the chunks, the bodies
+   and the variants of the bodies, laid out just as they are in memory, so a
+   compiled program only loads on the kind of machine that wrote it */
+struct ImageHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t num_chunks;
+    uint64_t num_bodies;
+    uint64_t checksum; /* Of everything after the header */
+};
+
+/* Works through the bytes eight at a time */
+uint64_t checksum(uint64_t hash, const void *data, size_t len) {
+    const unsigned char *bytes = data;
+    uint64_t word;
+    size_t i;
+
+    for (i = 0; i + 8 <= len; i += 8) {
+        memcpy(&word, bytes + i, 8);
+        hash = (hash ^ word) * CHECKSUM_PRIME;
+        hash ^= hash >> 32;
+    }
+    for (; i < len; i++) {
+        hash = (hash ^ bytes[i]) * CHECKSUM_PRIME;
+    }
+    return hash;
+}
+
+/* Works out the checksum of the loaded program */
+uint64_t checksum_code() {
+    uint64_t hash = CHECKSUM_BASIS;
+
+    hash = checksum(hash, code.chunks, sizeof(uint32_t) * code.num_chunks);
+    hash = checksum(hash, code.bodies, sizeof(uint32_t) * code.num_bodies);
+    return checksum(hash, code.variants,
+                    sizeof(struct Variant) * 2 * code.num_bodies);
+}
+
+void write_image(const char *output_name) {
+    FILE *out = output_name != NULL ? fopen(output_name, "wb") : stdout;
+    struct ImageHeader header;
+    bool ok;
+
+    if (out == NULL) {
+        fprintf(stderr, "Error! Unable to open %s!\n", output_name);
+        exit(1);
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+    header.version = IMAGE_VERSION;
+    header.num_chunks = code.num_chunks;
+    header.num_bodies = code.num_bodies;
+    header.checksum = checksum_code();
+
+    ok = fwrite(&header, sizeof(header), 1, out) == 1
+      && fwrite(code.chunks, sizeof(uint32_t), code.num_chunks, out)
+         == code.num_chunks
+      && fwrite(code.bodies, sizeof(uint32_t), code.num_bodies, out)
+         == code.num_bodies
+      && fwrite(code.variants, sizeof(struct Variant), 2 * code.num_bodies,
+                out) == 2 * code.num_bodies;
+    if ((output_name != NULL ? fclose(out) : fflush(out)) != 0 || !ok) {
+        fprintf(stderr, "Error! Unable to write the compiled program!\n");
+        exit(1);
+    }
+}
+
+/* Checks that a variant from a compiled program only holds ops that the
+   cores can run, and that what's recorded about them is what they do, since
+   the cores skip checks based on it */
+bool valid_variant(const struct Variant *variant) {
+    struct Variant analyzed = *variant;
+    unsigned i;
+
+    if (variant->len > COMMANDS_PER_CHUNK) {
+        return false;
+    }
+    for (i = 0; i < variant->len; i++) {
+        switch (variant->ops[i]) {
+            case OP_SKIP_UNVISITED:
+            case OP_END_CHUNK:
+            case OP_SKIP_VISITED:
+            case OP_NOP:
+                return false;
+            default:
+                if (variant->ops[i] >= OP_NEXT_CHUNK) {
+                    return false;
+                }
+                break;
+        }
+    }
+    analyze_variant(&analyzed);
+    return memcmp(&analyzed, variant, sizeof(analyzed)) == 0;
+}
+
+/* Checks the parts of a compiled program that the cores index with, so that
+   even a program that was tampered with to match its checksum can't make
+   them read out of bounds */
+bool valid_image() {
+    uint32_t largest = 0;
+    size_t i;
+
+    for (i = 0; i < code.num_chunks; i++) {
+        largest = code.chunks[i] > largest ? code.chunks[i] : largest;
+    }
+    if (code.num_chunks > 0 && largest >= code.num_bodies) {
+        return false;
+    }
+    for (i = 0; i < code.num_bodies; i++) {
+        if (code.bodies[i] >= CHUNK_VISITED
+            || !valid_variant(&code.variants[i * 2])
+            || !valid_variant(&code.variants[i * 2 + 1]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool load_image(int fd, const char *filename) {
+    struct ImageHeader header;
+    struct stat info;
+    unsigned char *image;
+    size_t len;
+
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header)
+        || memcmp(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0)
+    {
+        return false;
+    }
+    if (header.version != IMAGE_VERSION) {
+        fprintf(stderr, "Error! %s was compiled by a different version of "
+                        "xrf!\n", filename);
+        exit(1);
+    }
+
+    /* The sizes are checked against the length of the file before they're
+       multiplied, so they can't overflow */
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t) sizeof(header)) {
+        goto invalid;
+    }
+    len = info.st_size;
+    if (header.num_bodies > CHUNK_VISITED
+        || header.num_chunks > (len - sizeof(header)) / sizeof(uint32_t)
+        || len != sizeof(header) + sizeof(uint32_t) * header.num_chunks
+                  + (sizeof(uint32_t) + sizeof(struct Variant) * 2)
+                    * header.num_bodies)
+    {
+        goto invalid;
+    }
+
+    /* The mapping is private and writable, so the chunks can be marked
+       visited in place, copying only the pages that are written to */
+    image = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (image == MAP_FAILED) {
+        fprintf(stderr, "Error! Unable to allocate additional "
+                        "space for the code!\n");
+        exit(1);
+    }
+    code.image = image;
+    code.image_len = len;
+    code.num_chunks = header.num_chunks;
+    code.num_bodies = header.num_bodies;
+    code.chunks = (uint32_t *) (image + sizeof(header));
+    code.bodies = code.chunks + code.num_chunks;
+    code.variants = (struct Variant *) (code.bodies + code.num_bodies);
+    atexit(free_xrf_code);
+
+    if (checksum_code() == header.checksum && valid_image()) {
+        return true;
+    }
+
+invalid:
+    fprintf(stderr, "Error! %s is not a valid compiled program!\n",
+            filename);
+    exit(1);
+}
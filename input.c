@@ -0,0 +1,75 @@
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "xrf.h"
+
+struct Input input;
+
+/* Unmaps or frees whatever input was read into */
+void free_input() {
+    if (input.map != NULL) {
+        munmap(input.map, input.map_len);
+    }
+    free(input.buf);
+}
+
+void init_input() {
+    struct stat info;
+    off_t offset;
+
+    input.pos = input.end = NULL;
+    input.buf = NULL;
+    input.map = NULL;
+    input.eof = false;
+    atexit(free_input);
+
+    /* A regular file is mapped whole, and read from wherever stdin's offset
+       was left */
+    offset = lseek(STDIN_FILENO, 0, SEEK_CUR);
+    if (fstat(STDIN_FILENO, &info) == 0 && S_ISREG(info.st_mode)
+        && offset >= 0 && offset < info.st_size)
+    {
+        void *map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE,
+                         STDIN_FILENO, 0);
+
+        if (map != MAP_FAILED) {
+            madvise(map, info.st_size, MADV_SEQUENTIAL);
+            input.map = map;
+            input.map_len = info.st_size;
+            input.pos = (unsigned char *) map + offset;
+            input.end = (unsigned char *) map + info.st_size;
+            return;
+        }
+    }
+
+    input.buf = malloc(INPUT_BUFFER_SIZE);
+    if (input.buf == NULL) {
+        fprintf(stderr, "Error! Unable to allocate space for input!\n");
+        exit(1);
+    }
+}
+
+bool refill_input() {
+    ssize_t n;
+
+    /* A mapped file has nothing more to read once it runs out */
+    if (input.eof || input.map != NULL) {
+        input.eof = true;
+        return false;
+    }
+    if (output.flush_char >= 0 && output.len > 0) {
+        flush_output();
+    }
+    do {
+        n = read(STDIN_FILENO, input.buf, INPUT_BUFFER_SIZE);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+        input.eof = true;
+        return false;
+    }
+    input.pos = input.buf;
+    input.end = input.buf + n;
+    return true;
+}
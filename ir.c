@@ -0,0 +1,412 @@
+#include <string.h>
+
+#include "xrf.h"
+
+/* Appends an instruction to a segment, simplifying it on the way in. Ops on
+   constants are folded, runs of increments or of decrements are combined,
+   and ops that leave a value as it was return that value instead of a new
+   one. Increments and decrements aren't combined with each other, since an
+   increment can wrap around to zero. Returns the value the instruction
+   produces */
+unsigned ir_emit(struct IrSegment *seg, unsigned char op, unsigned a,
+                 unsigned b, unsigned int imm)
+{
+    const struct IrInst *x = &seg->insts[a], *y = &seg->insts[b];
+    struct IrInst *inst;
+
+    switch (op) {
+        case IR_ADD:
+            if (x->op == IR_CONST) {
+                return ir_emit(seg, IR_ADD_IMM, b, 0, x->imm);
+            } else if (y->op == IR_CONST) {
+                return ir_emit(seg, IR_ADD_IMM, a, 0, y->imm);
+            }
+            break;
+        case IR_ADD_IMM:
+            if (imm == 0) {
+                return a;
+            } else if (x->op == IR_CONST) {
+                return ir_emit(seg, IR_CONST, 0, 0, x->imm + imm);
+            } else if (x->op == IR_ADD_IMM) {
+                return ir_emit(seg, IR_ADD_IMM, x->a, 0, x->imm + imm);
+            }
+            break;
+        case IR_SUB_SAT:
+            if (x->op == IR_CONST) {
+                return ir_emit(seg, IR_CONST, 0, 0,
+                               x->imm > imm ? x->imm - imm : 0);
+            } else if (x->op == IR_SUB_SAT) {
+                return ir_emit(seg, IR_SUB_SAT, x->a, 0, x->imm + imm);
+            }
+            break;
+        case IR_DIFF:
+            if (a == b) {
+                return ir_emit(seg, IR_CONST, 0, 0, 0);
+            } else if (x->op == IR_CONST && y->op == IR_CONST) {
+                return ir_emit(seg, IR_CONST, 0, 0, x->imm > y->imm
+                                                    ? x->imm - y->imm
+                                                    : y->imm - x->imm);
+            } else if (x->op == IR_CONST && x->imm == 0) {
+                return b;
+            } else if (y->op == IR_CONST && y->imm == 0) {
+                return a;
+            }
+            break;
+    }
+
+    inst = &seg->insts[seg->num_insts];
+    inst->op = op;
+    inst->a = a;
+    inst->b = b;
+    inst->imm = imm;
+    inst->live = false;
+    return seg->num_insts++;
+}
+
+/* Pops a value off the abstract stack of a segment. Once the values pushed
+   in the segment run out, the values below are loaded from the stack the
+   segment started with */
+unsigned ir_pop(struct IrSegment *seg) {
+    if (seg->depth > 0) {
+        return seg->stack[--seg->depth];
+    }
+    return ir_emit(seg, IR_LOAD, 0, 0, seg->consumed++);
+}
+
+void ir_push(struct IrSegment *seg, unsigned value) {
+    seg->stack[seg->depth++] = value;
+}
+
+/* Returns whether the ith value from the top that a segment leaves is one
+   it loaded from the slot it ends up in, so it never has to be stored */
+bool ir_in_place(const struct IrSegment *seg, unsigned i) {
+    const struct IrInst *inst = &seg->insts[seg->stack[seg->depth - 1 - i]];
+
+    return inst->op == IR_LOAD
+           && inst->imm + seg->depth == seg->consumed + i;
+}
+
+/* Marks the instructions whose values have to be stored or are output as
+   live, along with the instructions those depend on. Input is always live,
+   since it reads a character whether or not it's used */
+void ir_mark_live(struct IrSegment *seg) {
+    unsigned i;
+
+    for (i = 0; i < seg->depth; i++) {
+        if (!ir_in_place(seg, i)) {
+            seg->insts[seg->stack[seg->depth - 1 - i]].live = true;
+        }
+    }
+    for (i = seg->num_insts; i-- > 0;) {
+        struct IrInst *inst = &seg->insts[i];
+
+        if (inst->op == IR_INPUT || inst->op == IR_OUTPUT) {
+            inst->live = true;
+        }
+        if (!inst->live) {
+            continue;
+        }
+        switch (inst->op) {
+            case IR_ADD:
+            case IR_DIFF:
+                seg->insts[inst->b].live = true;
+                /* Fall through */
+            case IR_OUTPUT:
+            case IR_ADD_IMM:
+            case IR_SUB_SAT:
+                seg->insts[inst->a].live = true;
+                break;
+        }
+    }
+}
+
+/* Ends a segment. Values at the bottom of what it leaves that it only
+   loaded from the slots they were already in are left out of both what it
+   takes and what it leaves, so that ops that put values back where they
+   were lift the same as no ops at all */
+void ir_end_segment(struct IrSegment *seg) {
+    unsigned i;
+
+    while (seg->depth > 0 && seg->consumed > 0
+           && seg->insts[seg->stack[0]].op == IR_LOAD
+           && seg->insts[seg->stack[0]].imm == seg->consumed - 1u)
+    {
+        seg->consumed--;
+        seg->depth--;
+        for (i = 0; i < seg->depth; i++) {
+            seg->stack[i] = seg->stack[i + 1];
+        }
+    }
+}
+
+/* Starts a new, empty segment of a lifted variant */
+struct IrSegment *ir_start_segment(struct IrVariant *ir) {
+    struct IrSegment *seg = &ir->segments[ir->num_segments++];
+
+    seg->num_insts = 0;
+    seg->depth = 0;
+    seg->consumed = 0;
+    seg->barrier = OP_END_CHUNK;
+    return seg;
+}
+
+/* Lifts ops into the IR. The ops are split into segments at the ops that
+   need the whole stack, each of which is left to run as it is between the
+   segments */
+void lift_ops(const unsigned char *ops, unsigned len, struct IrVariant *ir) {
+    struct IrSegment *seg;
+    unsigned i, a, b;
+
+    ir->num_segments = 0;
+    seg = ir_start_segment(ir);
+    for (i = 0; i < len; i++) {
+        switch (ops[i]) {
+            case OP_INPUT:
+                ir_push(seg, ir_emit(seg, IR_INPUT, 0, 0, 0));
+                break;
+            case OP_OUTPUT:
+                ir_emit(seg, IR_OUTPUT, ir_pop(seg), 0, 0);
+                break;
+            case OP_POP:
+                ir_pop(seg);
+                break;
+            case OP_DUP:
+                a = ir_pop(seg);
+                ir_push(seg, a);
+                ir_push(seg, a);
+                break;
+            case OP_SWAP:
+                a = ir_pop(seg);
+                b = ir_pop(seg);
+                ir_push(seg, a);
+                ir_push(seg, b);
+                break;
+            case OP_INC:
+                ir_push(seg, ir_emit(seg, IR_ADD_IMM, ir_pop(seg), 0, 1));
+                break;
+            case OP_DEC:
+                ir_push(seg, ir_emit(seg, IR_SUB_SAT, ir_pop(seg), 0, 1));
+                break;
+            case OP_ADD:
+                a = ir_pop(seg);
+                b = ir_pop(seg);
+                ir_push(seg, ir_emit(seg, IR_ADD, b, a, 0));
+                break;
+            case OP_SUB:
+                a = ir_pop(seg);
+                b = ir_pop(seg);
+                ir_push(seg, ir_emit(seg, IR_DIFF, b, a, 0));
+                break;
+            case OP_BOTTOM:
+            case OP_RANDOMIZE:
+            case OP_EXIT:
+                seg->barrier = ops[i];
+                ir_end_segment(seg);
+                seg = ir_start_segment(ir);
+                break;
+        }
+    }
+    ir_end_segment(seg);
+}
+
+/* Lifts the ops of a variant into the IR, and works out which instructions
+   are live */
+void lift_variant(const struct Variant *variant, struct IrVariant *ir) {
+    unsigned i;
+
+    lift_ops(variant->ops, variant->len, ir);
+    for (i = 0; i < ir->num_segments; i++) {
+        ir_mark_live(&ir->segments[i]);
+    }
+}
+
+/* Returns how many inputs a segment reads before the given one */
+unsigned ir_input_number(const struct IrSegment *seg, unsigned value) {
+    unsigned i, n = 0;
+
+    for (i = 0; i < value; i++) {
+        n += seg->insts[i].op == IR_INPUT;
+    }
+    return n;
+}
+
+/* Returns whether value a of segment sa is always the same as value b of
+   segment sb, given that both segments start on the same stack and read the
+   same input. Sums and differences don't depend on the order of their
+   operands */
+bool ir_same_value(const struct IrSegment *sa, unsigned a,
+                   const struct IrSegment *sb, unsigned b)
+{
+    const struct IrInst *x = &sa->insts[a], *y = &sb->insts[b];
+
+    if (x->op != y->op) {
+        return false;
+    }
+    switch (x->op) {
+        case IR_LOAD:
+        case IR_CONST:
+            return x->imm == y->imm;
+        case IR_INPUT:
+            return ir_input_number(sa, a) == ir_input_number(sb, b);
+        case IR_ADD_IMM:
+        case IR_SUB_SAT:
+            return x->imm == y->imm && ir_same_value(sa, x->a, sb, y->a);
+        case IR_ADD:
+        case IR_DIFF:
+            return (ir_same_value(sa, x->a, sb, y->a)
+                    && ir_same_value(sa, x->b, sb, y->b))
+                   || (ir_same_value(sa, x->a, sb, y->b)
+                       && ir_same_value(sa, x->b, sb, y->a));
+    }
+    return false;
+}
+
+/* Returns whether two lifted variants read and write the same characters in
+   the same order, and leave the stack the same */
+bool ir_same_effect(const struct IrVariant *a, const struct IrVariant *b) {
+    unsigned s, i, j;
+
+    if (a->num_segments != b->num_segments) {
+        return false;
+    }
+    for (s = 0; s < a->num_segments; s++) {
+        const struct IrSegment *sa = &a->segments[s], *sb = &b->segments[s];
+
+        if (sa->barrier != sb->barrier || sa->consumed != sb->consumed
+            || sa->depth != sb->depth)
+        {
+            return false;
+        }
+        for (i = 0; i < sa->depth; i++) {
+            if (!ir_same_value(sa, sa->stack[i], sb, sb->stack[i])) {
+                return false;
+            }
+        }
+
+        /* The inputs and outputs have to line up one for one */
+        for (i = 0, j = 0;; i++, j++) {
+            while (i < sa->num_insts && sa->insts[i].op != IR_INPUT
+                   && sa->insts[i].op != IR_OUTPUT)
+            {
+                i++;
+            }
+            while (j < sb->num_insts && sb->insts[j].op != IR_INPUT
+                   && sb->insts[j].op != IR_OUTPUT)
+            {
+                j++;
+            }
+            if (i == sa->num_insts || j == sb->num_insts) {
+                if (i != sa->num_insts || j != sb->num_insts) {
+                    return false;
+                }
+                break;
+            }
+            if (sa->insts[i].op != sb->insts[j].op
+                || (sa->insts[i].op == IR_OUTPUT
+                    && !ir_same_value(sa, sa->insts[i].a,
+                                      sb, sb->insts[j].a)))
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/* Returns whether an op can be dropped from a variant when lowering it,
+   which the ops that need the whole stack never are */
+bool droppable_op(unsigned char op) {
+    return op != OP_BOTTOM && op != OP_RANDOMIZE && op != OP_EXIT;
+}
+
+/* Returns whether any ops of a variant might cancel out, which takes a pop
+   or a swap */
+bool may_shrink(const struct Variant *variant) {
+    unsigned i;
+
+    for (i = 0; i < variant->len; i++) {
+        if (variant->ops[i] == OP_POP || variant->ops[i] == OP_SWAP) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Returns the most the stack grows above its depth on entry while ops run */
+int ops_growth(const unsigned char *ops, unsigned len) {
+    int depth = 0, growth = 0;
+    unsigned i;
+
+    for (i = 0; i < len; i++) {
+        depth += OP_EFFECTS[ops[i]].delta;
+        if (depth > growth) {
+            growth = depth;
+        }
+    }
+    return growth;
+}
+
+/* Lowers a variant into the ops that the threaded cores run, writing them
+   to fused and returning how many there are. The ops are the
+   shortest the lowering finds that lift to the same IR as the variant's own
+   ops, which it gets to by dropping one op or two ops in a row at a time
+   for as long as the IR stays the same. That drops ops that cancel out, like
+   a duplicate and a pop, two swaps, an increment right before a pop, or a
+   swap before an add. The ops left never need more stack than the variant's
+   own, so its guard still covers them, and the ops dropped could only have
+   failed by underflowing, which the guard checks for, so errors are
+   reported exactly as before. Runs of increments, decrements and pops then
+   become single ops with a count */
+unsigned lower_variant(const struct Variant *variant, struct FusedOp *fused) {
+    unsigned char ops[COMMANDS_PER_CHUNK], candidate[COMMANDS_PER_CHUNK];
+    struct IrVariant target, ir;
+    bool shrunk = may_shrink(variant);
+    unsigned i, j, n, len = variant->len, fused_len = 0;
+
+    memcpy(ops, variant->ops, len);
+    if (shrunk) {
+        lift_ops(ops, len, &target);
+    }
+    while (shrunk) {
+        shrunk = false;
+        for (i = 0; i < len && !shrunk; i++) {
+            for (n = 1; n <= 2 && i + n <= len && !shrunk; n++) {
+                if (!droppable_op(ops[i + n - 1])) {
+                    break;
+                }
+
+                /* Ops that change the depth of the stack between them can't
+                   be dropped */
+                if (OP_EFFECTS[ops[i]].delta
+                    + (n == 2 ? OP_EFFECTS[ops[i + 1]].delta : 0) != 0)
+                {
+                    continue;
+                }
+                for (j = 0; j < len - n; j++) {
+                    candidate[j] = ops[j < i ? j : j + n];
+                }
+                if (ops_growth(candidate, len - n) > variant->max_growth) {
+                    continue;
+                }
+                lift_ops(candidate, len - n, &ir);
+                if (ir_same_effect(&ir, &target)) {
+                    len -= n;
+                    memcpy(ops, candidate, len);
+                    shrunk = true;
+                }
+            }
+        }
+    }
+
+    for (i = 0; i < len; i++) {
+        if ((ops[i] == OP_INC || ops[i] == OP_DEC || ops[i] == OP_POP)
+            && fused_len > 0 && fused[fused_len - 1].op == ops[i])
+        {
+            fused[fused_len - 1].count++;
+        } else {
+            fused[fused_len].op = ops[i];
+            fused[fused_len++].count = 1;
+        }
+    }
+    return fused_len;
+}
@@ -0,0 +1,775 @@
+#include "xrf.h"
+
+#ifdef XRF_HAVE_JIT
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/* The x86-64 registers, numbered by their encoding */
+enum Reg {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+/* The callee-saved registers the compiled code keeps the interpreter state
+   in, so that it survives calls out to the C helpers */
+#define HEAD RBX       /* stack.head */
+#define VALS R12       /* stack.vals */
+#define MASK R13       /* stack.mask */
+#define DEPTH R14      /* stack_size */
+#define TABLE R15      /* jit_table */
+#define NUM_CHUNKS RBP /* code.num_chunks */
+
+/* The most stubs a single variant can branch out to */
+#define MAX_STUBS 2
+
+/* A buffer that machine code is written to. On the first pass buf is NULL
+   and only the size of the code is worked out */
+struct Emitter {
+    unsigned char *buf; /* Where the code goes, NULL when sizing */
+    size_t pos; /* How many bytes have been emitted */
+    struct {
+        size_t at; /* Position of the rel32 of the branch to the stub */
+        void (*helper)(); /* C helper that reports the error */
+        uint64_t arg; /* Argument the helper is called with */
+    } stubs[MAX_STUBS]; /* Error stubs the current variant branches to */
+    unsigned num_stubs;
+};
+
+/* The native code of every chunk variant, and the size of its mapping */
+unsigned char *jit_code;
+size_t jit_size;
+
+/* The code each chunk runs next, indexed by chunk. Entries start out at the
+   first-visit code of the chunk's body, which repoints the entry to the
+   revisit code. Since chunks share the code of their body, the index of the
+   running chunk is kept in the spare slot at the top of the native stack.
+   The table is padded past the last chunk with entries that report a
+   nonexistent chunk, so that variants that always go a fixed number of
+   chunks ahead can index it without a bounds check */
+void **jit_table;
+
+/* How many entries jit_table is padded with, which covers the furthest ahead
+   a variant can go */
+#define JIT_TABLE_PADDING COMMANDS_PER_CHUNK
+
+#ifdef XRF_SUCCESSOR_CACHE
+/* The chunk each chunk last went on to through the top of the stack, which
+   starts out as chunk 0, as in the threaded cores */
+static uint32_t *jit_successors;
+#endif
+
+/* Where the code of each variant of each unique body starts, indexed by the
+   body's index times two, plus one for the revisit code */
+unsigned char **jit_entries;
+
+void emit(struct Emitter *e, unsigned char byte) {
+    if (e->buf != NULL) {
+        e->buf[e->pos] = byte;
+    }
+    e->pos++;
+}
+
+void emit32(struct Emitter *e, uint32_t val) {
+    unsigned i;
+
+    for (i = 0; i < 4; i++) {
+        emit(e, val >> (i * 8));
+    }
+}
+
+void emit64(struct Emitter *e, uint64_t val) {
+    unsigned i;
+
+    for (i = 0; i < 8; i++) {
+        emit(e, val >> (i * 8));
+    }
+}
+
+/* Emits a REX prefix, leaving it out if it would have no effect */
+void emit_rex(struct Emitter *e, bool wide, int reg, int index, int base) {
+    unsigned char rex = 0x40 | (wide ? 8 : 0) | (reg >= 8 ? 4 : 0)
+                      | (index >= 8 ? 2 : 0) | (base >= 8 ? 1 : 0);
+
+    if (rex != 0x40) {
+        emit(e, rex);
+    }
+}
+
+/* Emits "op rm, reg" between two registers */
+void emit_rr(struct Emitter *e, bool wide, unsigned char opcode, int reg,
+             int rm)
+{
+    emit_rex(e, wide, reg, 0, rm);
+    emit(e, opcode);
+    emit(e, 0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+/* Emits "op rm, imm8" for the group 1 instruction with the given extension */
+void emit_ri(struct Emitter *e, bool wide, int ext, int rm, int8_t imm) {
+    emit_rex(e, wide, 0, 0, rm);
+    emit(e, 0x83);
+    emit(e, 0xC0 | ext << 3 | (rm & 7));
+    emit(e, imm);
+}
+
+/* Emits "op reg, dword [VALS + index * 4]", the stack cell at index */
+void emit_cell(struct Emitter *e, unsigned char opcode, int reg, int index) {
+    emit_rex(e, false, reg, index, VALS);
+    emit(e, opcode);
+    emit(e, (reg & 7) << 3 | 4);
+    emit(e, 0x80 | (index & 7) << 3 | (VALS & 7));
+}
+
+/* Emits "op reg, [rax + disp]" */
+void emit_mem(struct Emitter *e, bool wide, unsigned char opcode, int reg,
+              int8_t disp)
+{
+    emit_rex(e, wide, reg, 0, RAX);
+    emit(e, opcode);
+    emit(e, 0x40 | (reg & 7) << 3 | RAX);
+    emit(e, disp);
+}
+
+/* Emits "mov reg, imm64" */
+void emit_mov_imm(struct Emitter *e, int reg, uint64_t imm) {
+    emit_rex(e, true, 0, 0, reg);
+    emit(e, 0xB8 | (reg & 7));
+    emit64(e, imm);
+}
+
+/* Emits a call to a C function */
+void emit_call(struct Emitter *e, void (*fn)()) {
+    emit_mov_imm(e, RAX, (uintptr_t) fn);
+    emit(e, 0xFF);
+    emit(e, 0xD0);
+}
+
+/* The extensions of the group 1 instructions used with emit_ri */
+#define ADD 0
+#define AND 4
+#define SUB 5
+#define ADC 2
+#define CMP 7
+
+/* Writes the state kept in registers back to the globals */
+void emit_spill(struct Emitter *e) {
+    emit_mov_imm(e, RAX, (uintptr_t) &stack.head);
+    emit_mem(e, true, 0x89, HEAD, 0);
+    emit_mov_imm(e, RAX, (uintptr_t) &stack_size);
+    emit_mem(e, sizeof(stack_size) == 8, 0x89, DEPTH, 0);
+}
+
+/* Loads the state kept in registers from the globals */
+void emit_reload(struct Emitter *e) {
+    emit_mov_imm(e, RAX, (uintptr_t) &stack);
+    emit_mem(e, true, 0x8B, VALS, offsetof(struct Stack, vals));
+    emit_mem(e, true, 0x8B, HEAD, offsetof(struct Stack, head));
+    emit_mem(e, true, 0x8B, MASK, offsetof(struct Stack, mask));
+    emit_mov_imm(e, RAX, (uintptr_t) &stack_size);
+    emit_mem(e, sizeof(stack_size) == 8, 0x8B, DEPTH, 0);
+}
+
+/* Emits a call to a C helper that works on the global state */
+void emit_helper(struct Emitter *e, void (*fn)()) {
+    emit_spill(e);
+    emit_call(e, fn);
+    emit_reload(e);
+}
+
+/* Emits a conditional branch to a cold stub that spills the state and calls
+   helper with arg, which is only reached when helper will report an error */
+void emit_guard(struct Emitter *e, unsigned char cond, void (*helper)(),
+                uint64_t arg)
+{
+    emit(e, 0x0F);
+    emit(e, 0x80 | cond);
+    emit32(e, 0);
+    e->stubs[e->num_stubs].at = e->pos - 4;
+    e->stubs[e->num_stubs].helper = helper;
+    e->stubs[e->num_stubs++].arg = arg;
+}
+
+#define JB 0x2
+#define JAE 0x3
+#define JBE 0x6
+
+/* Emits the stubs the current variant branches to */
+void emit_stubs(struct Emitter *e) {
+    unsigned i;
+
+    for (i = 0; i < e->num_stubs; i++) {
+        if (e->buf != NULL) {
+            uint32_t rel = e->pos - (e->stubs[i].at + 4);
+
+            memcpy(e->buf + e->stubs[i].at, &rel, 4);
+        }
+        emit_spill(e);
+        emit_mov_imm(e, RDI, e->stubs[i].arg);
+        emit_call(e, e->stubs[i].helper);
+        emit(e, 0x0F);
+        emit(e, 0x0B);
+    }
+    e->num_stubs = 0;
+}
+
+/* Drops the top n values of the stack */
+void emit_drop(struct Emitter *e, int8_t n) {
+    emit_ri(e, true, ADD, HEAD, n);
+    emit_rr(e, true, 0x21, MASK, HEAD);
+    emit_ri(e, true, SUB, DEPTH, n);
+}
+
+/* Reads a character for the compiled code, or 0 at the end of input */
+unsigned int jit_read_char() {
+    int c = read_input();
+
+    return c == EOF ? 0 : (unsigned) c;
+}
+
+void jit_write_char(unsigned int c) {
+    write_output(c);
+}
+
+/* Runs a variant that failed its guard with all of its checks, which reports
+   either an underflow or the stack being left empty at the end. The variant
+   is given as its body's index times two, plus one on a revisit */
+void jit_fallback(size_t variant) {
+    execute_chunk(code.bodies[variant / 2], variant % 2);
+    next_chunk(code.chunks);
+}
+
+/* Reports that the top of the stack isn't a chunk */
+void jit_transition_error() {
+    next_chunk(code.chunks);
+}
+
+/* Emits the code of an op that needs the whole stack, which runs between
+   the segments of a lifted variant. The guard on entry to the variant has
+   already made sure that the stack isn't empty */
+void emit_barrier(struct Emitter *e, unsigned char op) {
+    switch (op) {
+        case OP_BOTTOM:
+            /* Moving the head down leaves the old top in the slot just
+               past the bottom, where it's stored again. This also holds
+               for a one-value stack */
+            emit_cell(e, 0x8B, RAX, HEAD);
+            emit_ri(e, true, ADD, HEAD, 1);
+            emit_rr(e, true, 0x21, MASK, HEAD);
+            emit_rr(e, true, 0x89, HEAD, RCX);
+            emit_rr(e, true, 0x01, DEPTH, RCX);
+            emit_ri(e, true, SUB, RCX, 1);
+            emit_rr(e, true, 0x21, MASK, RCX);
+            emit_cell(e, 0x89, RAX, RCX);
+            break;
+        case OP_EXIT:
+            emit_spill(e);
+            emit_rr(e, false, 0x31, RDI, RDI);
+            emit_call(e, (void (*)()) exit);
+            break;
+        case OP_RANDOMIZE:
+            emit_helper(e, randomize_stack);
+            break;
+    }
+}
+
+/* How many bytes the compiled code reserves on the native stack, which is
+   the slot holding the running chunk, then a slot for each value of a
+   segment that isn't kept in a register, and enough besides to keep the
+   stack 16-byte aligned for calls out to C */
+#define JIT_FRAME 72
+
+/* Where the values of a segment are kept, indexed by the instruction that
+   defines them. A register, or SLOT_HOME for the value's slot in the frame */
+#define SLOT_HOME (-1)
+
+/* The registers values are kept in. rax and rcx are left free for working
+   the values out, and the callee-saved registers hold the interpreter
+   state */
+const signed char VALUE_REGS[] = { RDX, RSI, RDI, R8, R9, R10, R11 };
+
+/* Emits "op r32, imm32" for the group 1 instruction with the given
+   extension */
+void emit_ri32(struct Emitter *e, int ext, int rm, uint32_t imm) {
+    emit_rex(e, false, 0, 0, rm);
+    emit(e, 0x81);
+    emit(e, 0xC0 | ext << 3 | (rm & 7));
+    emit32(e, imm);
+}
+
+/* Emits "op reg, value" for an op with a r32, r/m32 form, where value is
+   in its home */
+void emit_value(struct Emitter *e, unsigned char opcode, int reg,
+                const signed char *homes, unsigned value)
+{
+    if (homes[value] != SLOT_HOME) {
+        emit_rr(e, false, opcode, reg, homes[value]);
+        return;
+    }
+    /* op reg, dword [rsp + 8 + value * 4] */
+    emit_rex(e, false, reg, 0, RSP);
+    emit(e, opcode);
+    emit(e, 0x44 | (reg & 7) << 3);
+    emit(e, 0x24);
+    emit(e, 8 + value * 4);
+}
+
+/* Emits the stores of eax into the home of value */
+void emit_home(struct Emitter *e, const signed char *homes, unsigned value) {
+    if (homes[value] != SLOT_HOME) {
+        emit_rr(e, false, 0x89, RAX, homes[value]);
+    } else {
+        emit_value(e, 0x89, RAX, homes, value);
+    }
+}
+
+/* Sets rcx to the index of the stack cell offset values down from the top,
+   and returns the register holding that index */
+int emit_cell_index(struct Emitter *e, int offset) {
+    if (offset == 0) {
+        return HEAD;
+    }
+    emit_rr(e, true, 0x89, HEAD, RCX);
+    emit_ri(e, true, ADD, RCX, offset);
+    emit_rr(e, true, 0x21, MASK, RCX);
+    return RCX;
+}
+
+/* Works out where each live value of a segment is kept. Each value needs
+   its home from the instruction that defines it up to the last one that
+   uses it, or to the end of the segment if it's stored then. Values get
+   registers no other value needs at the same time, unless a character is
+   read or written while they're needed, since the call clobbers them */
+void place_values(const struct IrSegment *seg, signed char *homes) {
+    unsigned char last_use[IR_MAX_INSTS];
+    unsigned i, j, r;
+
+    for (i = 0; i < seg->num_insts; i++) {
+        const struct IrInst *inst = &seg->insts[i];
+
+        last_use[i] = i;
+        if (!inst->live) {
+            continue;
+        }
+        switch (inst->op) {
+            case IR_ADD:
+            case IR_DIFF:
+                last_use[inst->b] = i;
+                /* Fall through */
+            case IR_OUTPUT:
+            case IR_ADD_IMM:
+            case IR_SUB_SAT:
+                last_use[inst->a] = i;
+                break;
+        }
+    }
+    for (i = 0; i < seg->depth; i++) {
+        if (!ir_in_place(seg, i)) {
+            last_use[seg->stack[seg->depth - 1 - i]] = seg->num_insts;
+        }
+    }
+
+    for (i = 0; i < seg->num_insts; i++) {
+        bool taken[sizeof(VALUE_REGS)] = { false };
+
+        homes[i] = SLOT_HOME;
+        if (!seg->insts[i].live || seg->insts[i].op == IR_OUTPUT) {
+            continue;
+        }
+        for (j = i + 1; j < last_use[i]; j++) {
+            if (seg->insts[j].op == IR_INPUT
+                || seg->insts[j].op == IR_OUTPUT)
+            {
+                break;
+            }
+        }
+        if (j < last_use[i]) {
+            continue;
+        }
+        for (j = 0; j < i; j++) {
+            if (homes[j] != SLOT_HOME && last_use[j] >= i) {
+                for (r = 0; r < sizeof(VALUE_REGS); r++) {
+                    taken[r] |= VALUE_REGS[r] == homes[j];
+                }
+            }
+        }
+        r = 0;
+        while (r < sizeof(VALUE_REGS) && taken[r]) {
+            r++;
+        }
+        if (r < sizeof(VALUE_REGS)) {
+            homes[i] = VALUE_REGS[r];
+        }
+    }
+}
+
+/* Emits the code of a segment of a lifted variant, which the guard on entry
+   to the variant has already made sure the stack is deep enough and has
+   room for. Like the C that emit_c writes for it, the values are worked out
+   apart from the stack, and only those left on the stack are stored, and
+   only if they aren't already in the right cell */
+void emit_segment(struct Emitter *e, const struct IrSegment *seg) {
+    signed char homes[IR_MAX_INSTS];
+    int shift = seg->consumed - seg->depth;
+    unsigned i;
+
+    place_values(seg, homes);
+    for (i = 0; i < seg->num_insts; i++) {
+        const struct IrInst *inst = &seg->insts[i];
+
+        if (!inst->live) {
+            continue;
+        }
+        switch (inst->op) {
+            case IR_LOAD:
+                emit_cell(e, 0x8B, RAX, emit_cell_index(e, inst->imm));
+                break;
+            case IR_CONST:
+                /* mov eax, imm32 */
+                emit(e, 0xB8);
+                emit32(e, inst->imm);
+                break;
+            case IR_INPUT:
+                emit_call(e, (void (*)(void)) jit_read_char);
+                break;
+            case IR_OUTPUT:
+                emit_value(e, 0x8B, RDI, homes, inst->a);
+                emit_call(e, (void (*)()) jit_write_char);
+                continue;
+            case IR_ADD:
+                emit_value(e, 0x8B, RAX, homes, inst->a);
+                emit_value(e, 0x03, RAX, homes, inst->b);
+                break;
+            case IR_ADD_IMM:
+                emit_value(e, 0x8B, RAX, homes, inst->a);
+                emit_ri32(e, ADD, RAX, inst->imm);
+                break;
+            case IR_SUB_SAT:
+                /* Subtracting more than the value borrows, in which case
+                   sbb sets ecx to all ones, and and-ing with its inverse
+                   leaves zero */
+                emit_value(e, 0x8B, RAX, homes, inst->a);
+                emit_ri32(e, SUB, RAX, inst->imm);
+                emit_rr(e, false, 0x19, RCX, RCX);
+                emit(e, 0xF7);
+                emit(e, 0xD0 | RCX);
+                emit_rr(e, false, 0x21, RCX, RAX);
+                break;
+            case IR_DIFF:
+                /* a - b borrows when b is larger, and then sbb sets ecx to
+                   all ones, with which xor and sub negate the result */
+                emit_value(e, 0x8B, RAX, homes, inst->a);
+                emit_value(e, 0x2B, RAX, homes, inst->b);
+                emit_rr(e, false, 0x19, RCX, RCX);
+                emit_rr(e, false, 0x31, RCX, RAX);
+                emit_rr(e, false, 0x29, RCX, RAX);
+                break;
+        }
+        emit_home(e, homes, i);
+    }
+
+    /* The ith value from the top ends up shift + i cells down from the old
+       top */
+    for (i = 0; i < seg->depth; i++) {
+        unsigned value = seg->stack[seg->depth - 1 - i];
+        int reg = RAX;
+
+        if (ir_in_place(seg, i)) {
+            continue;
+        }
+        if (homes[value] != SLOT_HOME) {
+            reg = homes[value];
+        } else {
+            emit_value(e, 0x8B, RAX, homes, value);
+        }
+        emit_cell(e, 0x89, reg, emit_cell_index(e, shift + (int) i));
+    }
+    if (shift != 0) {
+        emit_drop(e, shift);
+    }
+}
+
+/* Emits "jmp rel32" to the code at pos */
+void emit_jump(struct Emitter *e, size_t pos) {
+    emit(e, 0xE9);
+    emit32(e, pos - (e->pos + 4));
+}
+
+#ifdef XRF_SUCCESSOR_CACHE
+/* Emits the check of the chunk in eax that the running chunk goes on to,
+   which is skipped when it's the one the running chunk last went on to.
+   Leaves rdx pointing at jit_successors */
+void emit_successor_check(struct Emitter *e) {
+    size_t skip;
+
+    /* mov rcx, [rsp]; cmp eax, [rdx + rcx * 4]; je past the check */
+    emit(e, 0x48);
+    emit(e, 0x8B);
+    emit(e, 0x0C);
+    emit(e, 0x24);
+    emit_mov_imm(e, RDX, (uintptr_t) jit_successors);
+    emit(e, 0x3B);
+    emit(e, 0x04);
+    emit(e, 0x8A);
+    emit(e, 0x74);
+    emit(e, 0);
+    skip = e->pos;
+    emit_rr(e, true, 0x39, NUM_CHUNKS, RAX);
+    emit_guard(e, JAE, jit_transition_error, 0);
+    /* mov [rdx + rcx * 4], eax */
+    emit(e, 0x89);
+    emit(e, 0x04);
+    emit(e, 0x8A);
+    if (e->buf != NULL) {
+        e->buf[skip - 1] = e->pos - skip;
+    }
+}
+
+/* Emits a prefetch of the code of the chunk that the chunk in rax last went
+   on to, with rdx pointing at jit_successors */
+void emit_successor_prefetch(struct Emitter *e) {
+    /* mov ecx, [rdx + rax * 4]; mov rcx, [TABLE + rcx * 8];
+       prefetcht0 [rcx] */
+    emit(e, 0x8B);
+    emit(e, 0x0C);
+    emit(e, 0x82);
+    emit(e, 0x49);
+    emit(e, 0x8B);
+    emit(e, 0x0C);
+    emit(e, 0xC0 | RCX << 3 | (TABLE & 7));
+    emit(e, 0x0F);
+    emit(e, 0x18);
+    emit(e, 0x09);
+}
+#endif
+
+/* Emits the code of one variant of a unique body. The first-visit code
+   begins by marking the running chunk visited and pointing its table entry at
+   the revisit code, which starts at revisit_pos. The variant then checks its
+   stack use once up front, so the ops don't need to. Its ops are lifted into
+   the IR, and the code of each segment is emitted from that, with the ops
+   that need the whole stack between them. A variant that always goes back
+   to its own chunk jumps straight to the revisit code */
+void emit_variant(struct Emitter *e, size_t unique, bool visited,
+                  size_t revisit_pos)
+{
+    const struct Variant *variant = &code.variants[unique * 2 + visited];
+    unsigned char *revisit_code = e->buf != NULL ? e->buf + revisit_pos
+                                                 : NULL;
+    struct IrVariant ir;
+    size_t skip;
+    unsigned i;
+
+    if (!visited) {
+        /* mov rax, [rsp]; mov [TABLE + rax * 8], rcx */
+        emit(e, 0x48);
+        emit(e, 0x8B);
+        emit(e, 0x04);
+        emit(e, 0x24);
+        emit_mov_imm(e, RCX, (uintptr_t) revisit_code);
+        emit(e, 0x49);
+        emit(e, 0x89);
+        emit(e, 0x0C);
+        emit(e, 0xC0 | (TABLE & 7));
+        /* Sets CHUNK_VISITED, which is bit 4 of the chunk's third byte, with
+           or byte [rcx + rax * 4 + 2] */
+        emit_mov_imm(e, RCX, (uintptr_t) code.chunks);
+        emit(e, 0x80);
+        emit(e, 0x4C);
+        emit(e, 0x81);
+        emit(e, 2);
+        emit(e, CHUNK_VISITED >> 16);
+    }
+
+    if (variant->min_depth > 0) {
+        emit_ri(e, true, CMP, DEPTH, variant->min_depth);
+        emit_guard(e, JB, (void (*)()) jit_fallback, unique * 2 + visited);
+    }
+    if (variant->max_growth > 0) {
+        /* Grows the stack if DEPTH + max_growth - 1 > MASK */
+        emit_rex(e, true, RAX, 0, DEPTH);
+        emit(e, 0x8D);
+        emit(e, 0x40 | RAX << 3 | (DEPTH & 7));
+        emit(e, variant->max_growth - 1);
+        emit_rr(e, true, 0x39, MASK, RAX);
+        emit(e, 0x70 | JBE);
+        emit(e, 0);
+        skip = e->pos;
+        emit_spill(e);
+        emit_mov_imm(e, RDI, variant->max_growth);
+        emit_call(e, reserve_stack);
+        emit_reload(e);
+        if (e->buf != NULL) {
+            e->buf[skip - 1] = e->pos - skip;
+        }
+    }
+
+    lift_variant(variant, &ir);
+    for (i = 0; i < ir.num_segments; i++) {
+        emit_segment(e, &ir.segments[i]);
+        emit_barrier(e, ir.segments[i].barrier);
+    }
+
+    if (variant->exit_delta == 0) {
+        /* The running chunk is still on top of the stack, so neither the
+           check nor the table are needed */
+        emit_jump(e, revisit_pos);
+    } else if (variant->exit_delta != EXIT_DYNAMIC) {
+        /* The next chunk is the running one plus exit_delta, which the
+           padding of the table covers, so it's found without reading the
+           stack or checking it. With mov rax, [rsp]; mov [rsp], rax */
+        emit(e, 0x48);
+        emit(e, 0x8B);
+        emit(e, 0x04);
+        emit(e, 0x24);
+        emit_ri(e, true, ADD, RAX, variant->exit_delta);
+        emit(e, 0x48);
+        emit(e, 0x89);
+        emit(e, 0x04);
+        emit(e, 0x24);
+        emit(e, 0x41);
+        emit(e, 0xFF);
+        emit(e, 0x24);
+        emit(e, 0xC0 | RAX << 3 | (TABLE & 7));
+    } else if (variant->len == 0
+               || variant->ops[variant->len - 1] != OP_EXIT)
+    {
+        /* Jumps through the table to the chunk on top of the stack, which
+           the guard made sure is there */
+        emit_cell(e, 0x8B, RAX, HEAD);
+#ifdef XRF_SUCCESSOR_CACHE
+        emit_successor_check(e);
+#else
+        emit_rr(e, true, 0x39, NUM_CHUNKS, RAX);
+        emit_guard(e, JAE, jit_transition_error, 0);
+#endif
+        /* mov [rsp], rax */
+        emit(e, 0x48);
+        emit(e, 0x89);
+        emit(e, 0x04);
+        emit(e, 0x24);
+#ifdef XRF_SUCCESSOR_CACHE
+        emit_successor_prefetch(e);
+#endif
+        emit(e, 0x41);
+        emit(e, 0xFF);
+        emit(e, 0x24);
+        emit(e, 0xC0 | RAX << 3 | (TABLE & 7));
+    }
+
+    emit_stubs(e);
+}
+
+/* Emits the entry point, which starts at chunk 0, followed by the code that
+   the padding of the table points to, and then the code of every unique
+   body. Returns where the padding code starts */
+size_t emit_program(struct Emitter *e) {
+    static const unsigned char saved[] = { RBX, RBP, R12, R13, R14, R15 };
+    size_t i, padding_pos;
+    unsigned j;
+
+    for (j = 0; j < sizeof(saved); j++) {
+        emit_rex(e, false, 0, 0, saved[j]);
+        emit(e, 0x50 | (saved[j] & 7));
+    }
+    /* Makes the frame, and starts the slot that holds the running chunk
+       out as chunk 0, with mov qword [rsp], 0 */
+    emit_ri(e, true, SUB, RSP, JIT_FRAME);
+    emit(e, 0x48);
+    emit(e, 0xC7);
+    emit(e, 0x04);
+    emit(e, 0x24);
+    emit32(e, 0);
+    emit_reload(e);
+    emit_mov_imm(e, TABLE, (uintptr_t) jit_table);
+    emit_mov_imm(e, NUM_CHUNKS, code.num_chunks);
+    emit(e, 0x41);
+    emit(e, 0xFF);
+    emit(e, 0x20 | (TABLE & 7));
+
+    padding_pos = e->pos;
+    emit_spill(e);
+    emit_call(e, jit_transition_error);
+    emit(e, 0x0F);
+    emit(e, 0x0B);
+
+    for (i = 0; i < code.num_bodies; i++) {
+        size_t revisit_pos = e->pos;
+
+        emit_variant(e, i, true, revisit_pos);
+        if (e->buf != NULL) {
+            jit_entries[i * 2] = e->buf + e->pos;
+            jit_entries[i * 2 + 1] = e->buf + revisit_pos;
+        }
+        emit_variant(e, i, false, revisit_pos);
+    }
+    return padding_pos;
+}
+
+/* Frees the compiled code */
+void free_jit() {
+    munmap(jit_code, jit_size);
+    free(jit_table);
+}
+
+#ifdef XRF_SUCCESSOR_CACHE
+void free_jit_successors() {
+    free(jit_successors);
+}
+#endif
+
+bool run_jit_engine() {
+    struct Emitter e = { NULL, 0, { { 0, NULL, 0 } }, 0 };
+    void *mapping;
+    size_t i, padding_pos;
+
+#ifdef XRF_SUCCESSOR_CACHE
+    jit_successors = calloc(code.num_chunks, sizeof(uint32_t));
+    if (jit_successors == NULL) {
+        return false;
+    }
+    atexit(free_jit_successors);
+#endif
+    emit_program(&e);
+    jit_size = e.pos;
+
+    jit_table = malloc(sizeof(void *)
+                       * (code.num_chunks + JIT_TABLE_PADDING));
+    jit_entries = malloc(sizeof(unsigned char *) * 2 * code.num_bodies);
+    if (jit_table == NULL || jit_entries == NULL) {
+        free(jit_table);
+        free(jit_entries);
+        return false;
+    }
+    mapping = mmap(NULL, jit_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+        free(jit_table);
+        free(jit_entries);
+        return false;
+    }
+    jit_code = mapping;
+    e.buf = jit_code;
+    e.pos = 0;
+    padding_pos = emit_program(&e);
+    for (i = 0; i < code.num_chunks; i++) {
+        jit_table[i] = jit_entries[CHUNK_UNIQUE(code.chunks[i]) * 2
+                                   + CHUNK_IS_VISITED(code.chunks[i])];
+    }
+    for (; i < code.num_chunks + JIT_TABLE_PADDING; i++) {
+        jit_table[i] = jit_code + padding_pos;
+    }
+    free(jit_entries);
+    if (mprotect(jit_code, jit_size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(jit_code, jit_size);
+        free(jit_table);
+        return false;
+    }
+    atexit(free_jit);
+
+    ((void (*)()) jit_code)();
+    return true;
+}
+
+#endif
@@ -0,0 +1,189 @@
+#include "xrf.h"
+
+#ifdef XRF_HAVE_NATIVE
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Identifies the build of xrf, so that code cached by a build that may have
+   translated programs differently isn't used. The Makefile sets it to a hash
+   of the sources, and any other build gets a cache of its own */
+#ifndef XRF_BUILD_ID
+#define XRF_BUILD_ID __DATE__ " " __TIME__
+#endif
+
+/* The function a cached program is entered through */
+#define NATIVE_ENTRY "xrf_main"
+
+/* The compiler used when $CC isn't set */
+#define DEFAULT_CC "cc"
+
+/* The directory the code is cached in, and the path of the program's shared
+   object in it. Both are empty if there's nowhere to cache code */
+static char native_dir[4096];
+static char native_path[4096 + 32];
+
+/* Works out the cache directory, creating it if it doesn't exist yet */
+bool find_native_dir() {
+    const char *base = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    int n;
+
+    if (base != NULL && base[0] == '/') {
+        n = snprintf(native_dir, sizeof(native_dir), "%s", base);
+    } else if (home != NULL && home[0] != '\0') {
+        n = snprintf(native_dir, sizeof(native_dir), "%s/.cache", home);
+    } else {
+        return false;
+    }
+    if (n < 0 || (size_t) n + 5 >= sizeof(native_dir)
+        || (mkdir(native_dir, 0700) != 0 && errno != EEXIST))
+    {
+        return false;
+    }
+    strcat(native_dir, "/xrf");
+    return mkdir(native_dir, 0700) == 0 || errno == EEXIST;
+}
+
+/* Returns the compiler that programs are built with */
+const char *native_compiler() {
+    const char *cc = getenv("CC");
+
+    return cc != NULL && cc[0] != '\0' ? cc : DEFAULT_CC;
+}
+
+/* Works out where the code of the program in the given file is cached. The
+   key hashes the text of the program together with the build of xrf, the
+   runtime the translated C starts with, and the compiler, so a change to
+   any of them misses */
+bool find_native_path(const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    const char *cc = native_compiler();
+    struct stat info;
+    void *text;
+    uint64_t hash;
+    size_t i;
+
+    if (fd < 0 || fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)
+        || info.st_size == 0)
+    {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+    text = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (text == MAP_FAILED) {
+        return false;
+    }
+    hash = checksum(CHECKSUM_BASIS, XRF_BUILD_ID, strlen(XRF_BUILD_ID) + 1);
+    for (i = 0; i < NUM_C_RUNTIME_LINES; i++) {
+        hash = checksum(hash, C_RUNTIME[i], strlen(C_RUNTIME[i]) + 1);
+    }
+    hash = checksum(hash, cc, strlen(cc) + 1);
+    hash = checksum(hash, text, info.st_size);
+    munmap(text, info.st_size);
+
+    if (!find_native_dir()) {
+        return false;
+    }
+    snprintf(native_path, sizeof(native_path), "%s/%016llx.so", native_dir,
+             (unsigned long long) hash);
+    return true;
+}
+
+/* Loads the cached code of the program and runs it, returning if it can't
+   be loaded. The code writes its output through stdio, so stdout is buffered
+   the way output was set up to be */
+void run_native_code() {
+    void *lib = dlopen(native_path, RTLD_NOW | RTLD_LOCAL);
+    int (*entry)(void);
+
+    if (lib == NULL) {
+        return;
+    }
+    *(void **) &entry = dlsym(lib, NATIVE_ENTRY);
+    if (entry == NULL) {
+        dlclose(lib);
+        return;
+    }
+    if (output.limit == 1) {
+        setvbuf(stdout, NULL, _IONBF, 0);
+    } else {
+        setvbuf(stdout, NULL, output.flush_char == '\n' ? _IOLBF : _IOFBF,
+                OUTPUT_BUFFER_SIZE);
+    }
+    exit(entry());
+}
+
+void run_cached_program(const char *filename) {
+    if (find_native_path(filename) && access(native_path, R_OK) == 0) {
+        run_native_code();
+    }
+}
+
+/* Compiles a translated program into a shared object, with the compiler's
+   own output thrown away */
+bool compile_native(const char *source, const char *object) {
+    pid_t pid = fork();
+    int status;
+
+    if (pid < 0) {
+        return false;
+    } else if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+
+        if (null >= 0) {
+            dup2(null, STDOUT_FILENO);
+            dup2(null, STDERR_FILENO);
+        }
+        execlp(native_compiler(), native_compiler(), "-O2", "-w", "-shared",
+               "-fPIC", "-o", object, source, (char *) NULL);
+        _exit(127);
+    }
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+void run_native_engine() {
+    char source[sizeof(native_path) + 32], object[sizeof(native_path) + 32];
+    FILE *out;
+    bool built;
+
+    if (native_path[0] == '\0') {
+        return;
+    }
+
+    /* The code is built under names of this process's own, and only renamed
+       into place once it's complete, so that other runs never see it half
+       written */
+    snprintf(source, sizeof(source), "%s.%ld.c", native_path, (long) getpid());
+    snprintf(object, sizeof(object), "%s.%ld.so", native_path,
+             (long) getpid());
+    out = fopen(source, "w");
+    if (out == NULL) {
+        return;
+    }
+    emit_c(out, native_path, NATIVE_ENTRY);
+    built = fclose(out) == 0 && compile_native(source, object)
+         && rename(object, native_path) == 0;
+    unlink(source);
+    if (!built) {
+        unlink(object);
+        return;
+    }
+    run_native_code();
+}
+
+#endif
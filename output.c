@@ -0,0 +1,56 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "xrf.h"
+
+struct Output output;
+
+/* The names of the flush policies, as given to --flush */
+const char *const FLUSH_POLICY_NAMES[] = {
+    [FLUSH_LINE] = "line",
+    [FLUSH_FULL] = "full",
+    [FLUSH_NONE] = "none"
+};
+
+void flush_output() {
+    size_t written = 0;
+
+    while (written < output.len) {
+        ssize_t n = write(STDOUT_FILENO, output.buf + written,
+                          output.len - written);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n <= 0) {
+            /* Like stdio, output that can't be written is dropped */
+            break;
+        }
+        written += n;
+    }
+    output.len = 0;
+}
+
+bool parse_flush_policy(const char *name, enum FlushPolicy *policy) {
+    unsigned i;
+
+    for (i = 0; i < sizeof(FLUSH_POLICY_NAMES) / sizeof(*FLUSH_POLICY_NAMES);
+         i++)
+    {
+        if (strcmp(name, FLUSH_POLICY_NAMES[i]) == 0) {
+            *policy = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+void init_output(enum FlushPolicy policy) {
+    if (policy == FLUSH_DEFAULT) {
+        policy = isatty(STDOUT_FILENO) ? FLUSH_LINE : FLUSH_FULL;
+    }
+    output.len = 0;
+    output.limit = policy == FLUSH_NONE ? 1 : OUTPUT_BUFFER_SIZE;
+    output.flush_char = policy == FLUSH_LINE ? '\n' : -1;
+    atexit(flush_output);
+}
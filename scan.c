@@ -0,0 +1,193 @@
+#include <ctype.h>
+
+#include "xrf.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define XRF_HAVE_SIMD
+#endif
+
+/* Validates and compacts text a byte at a time, stopping at the first byte
+   that's neither a command nor whitespace and setting *bad to where it is */
+size_t scan_commands_scalar(const unsigned char *text, size_t len,
+                            unsigned char *cmds, size_t *bad)
+{
+    size_t i, count = 0;
+
+    for (i = 0; i < len; i++) {
+        if (decode_command(text[i]) >= 0) {
+            cmds[count++] = text[i];
+        } else if (!isspace(text[i])) {
+            break;
+        }
+    }
+    *bad = i;
+    return count;
+}
+
+#ifdef XRF_HAVE_SIMD
+
+/* Copies the bytes of a block picked out by the bits of mask to cmds */
+static inline size_t compact_bits(const unsigned char *block, unsigned mask,
+                                  unsigned char *cmds)
+{
+    size_t count = 0;
+
+    while (mask != 0) {
+        cmds[count++] = block[__builtin_ctz(mask)];
+        mask &= mask - 1;
+    }
+    return count;
+}
+
+/* Validates and compacts whole 16-byte blocks of text, stopping early at a
+   block with a bad byte in it. Returns how many commands were found, and sets
+   *done to how much of the text was scanned */
+size_t compact_commands_sse2(const unsigned char *text, size_t len,
+                             unsigned char *cmds, size_t *done)
+{
+    const __m128i below_0 = _mm_set1_epi8('0' - 1);
+    const __m128i above_9 = _mm_set1_epi8('9' + 1);
+    const __m128i below_a = _mm_set1_epi8('A' - 1);
+    const __m128i above_f = _mm_set1_epi8('F' + 1);
+    const __m128i below_tab = _mm_set1_epi8('\t' - 1);
+    const __m128i above_cr = _mm_set1_epi8('\r' + 1);
+    const __m128i space = _mm_set1_epi8(' ');
+    size_t i, count = 0;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *) (text + i));
+        __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(block, below_0),
+                                      _mm_cmplt_epi8(block, above_9));
+        __m128i hex = _mm_and_si128(_mm_cmpgt_epi8(block, below_a),
+                                    _mm_cmplt_epi8(block, above_f));
+        __m128i ws = _mm_or_si128(
+            _mm_cmpeq_epi8(block, space),
+            _mm_and_si128(_mm_cmpgt_epi8(block, below_tab),
+                          _mm_cmplt_epi8(block, above_cr)));
+        unsigned cmd = _mm_movemask_epi8(_mm_or_si128(digit, hex));
+
+        if ((cmd | _mm_movemask_epi8(ws)) != 0xFFFF) {
+            break;
+        }
+        if (cmd == 0xFFFF) {
+            _mm_storeu_si128((__m128i *) (cmds + count), block);
+            count += 16;
+        } else {
+            count += compact_bits(text + i, cmd, cmds + count);
+        }
+    }
+    *done = i;
+    return count;
+}
+
+/* Shuffles that move the bytes picked out by each 8-bit mask to the front */
+unsigned char compact_shuffles[256][8];
+
+/* Fills in compact_shuffles */
+void init_compact_shuffles() {
+    unsigned mask, bit, n;
+
+    for (mask = 0; mask < 256; mask++) {
+        for (bit = 0, n = 0; bit < 8; bit++) {
+            if (mask & (1 << bit)) {
+                compact_shuffles[mask][n++] = bit;
+            }
+        }
+        while (n < 8) {
+            compact_shuffles[mask][n++] = 0x80;
+        }
+    }
+}
+
+/* The AVX2 version of compact_commands_sse2, working on 32-byte blocks. Mixed
+   blocks are compacted eight bytes at a time with shuffles */
+__attribute__((target("avx2")))
+size_t compact_commands_avx2(const unsigned char *text, size_t len,
+                             unsigned char *cmds, size_t *done)
+{
+    const __m256i below_0 = _mm256_set1_epi8('0' - 1);
+    const __m256i above_9 = _mm256_set1_epi8('9' + 1);
+    const __m256i below_a = _mm256_set1_epi8('A' - 1);
+    const __m256i above_f = _mm256_set1_epi8('F' + 1);
+    const __m256i below_tab = _mm256_set1_epi8('\t' - 1);
+    const __m256i above_cr = _mm256_set1_epi8('\r' + 1);
+    const __m256i space = _mm256_set1_epi8(' ');
+    size_t i, count = 0;
+    unsigned j;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i *) (text + i));
+        __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(block, below_0),
+                                         _mm256_cmpgt_epi8(above_9, block));
+        __m256i hex = _mm256_and_si256(_mm256_cmpgt_epi8(block, below_a),
+                                       _mm256_cmpgt_epi8(above_f, block));
+        __m256i ws = _mm256_or_si256(
+            _mm256_cmpeq_epi8(block, space),
+            _mm256_and_si256(_mm256_cmpgt_epi8(block, below_tab),
+                             _mm256_cmpgt_epi8(above_cr, block)));
+        unsigned cmd =
+            (unsigned) _mm256_movemask_epi8(_mm256_or_si256(digit, hex));
+
+        if ((cmd | (unsigned) _mm256_movemask_epi8(ws)) != 0xFFFFFFFF) {
+            break;
+        }
+        if (cmd == 0xFFFFFFFF) {
+            _mm256_storeu_si256((__m256i *) (cmds + count), block);
+            count += 32;
+            continue;
+        }
+
+        /* Each group of eight can store up to eight bytes past its last
+           command, which never reaches past the end of the block */
+        for (j = 0; j < 32; j += 8) {
+            unsigned mask = (cmd >> j) & 0xFF;
+            __m128i group = _mm_loadl_epi64((const __m128i *) (text + i + j));
+            __m128i shuffle =
+                _mm_loadl_epi64((const __m128i *) compact_shuffles[mask]);
+
+            _mm_storel_epi64((__m128i *) (cmds + count),
+                             _mm_shuffle_epi8(group, shuffle));
+            count += __builtin_popcount(mask);
+        }
+    }
+    *done = i;
+    return count;
+}
+
+/* The vector scanner picked by init_scanner */
+size_t (*vector_scanner)(const unsigned char *, size_t, unsigned char *,
+                         size_t *);
+
+#endif
+
+void init_scanner() {
+#ifdef XRF_HAVE_SIMD
+    if (__builtin_cpu_supports("avx2")) {
+        init_compact_shuffles();
+        vector_scanner = compact_commands_avx2;
+    } else {
+        vector_scanner = compact_commands_sse2;
+    }
+#endif
+}
+
+size_t scan_commands(const unsigned char *text, size_t len,
+                     unsigned char *cmds, size_t *bad)
+{
+    size_t count = 0, done = 0;
+
+#ifdef XRF_HAVE_SIMD
+    /* The vector scanners stop at the block holding a bad byte, which the
+       scalar scan then finds */
+    count = vector_scanner(text, len, cmds, &done);
+#endif
+    count += scan_commands_scalar(text + done, len - done, cmds + count, bad);
+    *bad += done;
+    return count;
+}
+
+void report_bad_character(unsigned char c) {
+    fprintf(stderr, "Error! Unknown character %c encountered!\n", c);
+    exit(1);
+}
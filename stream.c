@@ -0,0 +1,214 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "xrf.h"
+
+/* Streamed chunks are stored in segments of this many, so the chunks that
+   have been read never move while more are added */
+#define STREAM_SEGMENT_BITS 16
+#define STREAM_SEGMENT_SIZE ((size_t) 1 << STREAM_SEGMENT_BITS)
+#define MAX_STREAM_SEGMENTS ((size_t) 1 << 16)
+
+/* How much of the program the reader reads at a time */
+#define STREAM_BLOCK_SIZE (1 << 16)
+
+#define STREAM_CHUNK(index)                                  \
+    (&stream.segments[(index) >> STREAM_SEGMENT_BITS]        \
+                     [(index) & (STREAM_SEGMENT_SIZE - 1)])
+
+/* How far the reader has got through a streamed program */
+enum StreamState {
+    STREAM_LOADING,
+    STREAM_DONE,
+    STREAM_BAD_CHARACTER,
+    STREAM_BAD_LENGTH,
+    STREAM_NO_MEMORY
+};
+
+/* A program that's read by a background thread while it runs. The reader
+   adds chunks to the segments and then publishes how many there are under
+   the lock, and the interpreter only takes the lock when it goes to a chunk
+   past the ones it knows have been read. Since nothing is compiled from them,
+   streamed chunks aren't interned, and hold their packed bodies directly */
+struct Stream {
+    int fd;
+    pthread_t reader;
+    bool started;
+    pthread_mutex_t lock;
+    pthread_cond_t arrived;
+    size_t loaded;
+    enum StreamState state;
+    unsigned char bad_char;
+    uint32_t *segments[MAX_STREAM_SEGMENTS];
+};
+
+struct Stream stream = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .arrived = PTHREAD_COND_INITIALIZER
+};
+
+/* How many chunks the interpreter knows have been read */
+static size_t available;
+
+/* Packs whole chunks of commands into the segments after the loaded ones,
+   returning false if there's no room for them */
+bool store_chunks(const unsigned char *cmds, size_t num_chunks,
+                  size_t *loaded)
+{
+    size_t i;
+
+    for (i = 0; i < num_chunks; i++, (*loaded)++) {
+        size_t segment = *loaded >> STREAM_SEGMENT_BITS;
+
+        if (segment == MAX_STREAM_SEGMENTS) {
+            return false;
+        }
+        if (stream.segments[segment] == NULL) {
+            stream.segments[segment] =
+                malloc(sizeof(uint32_t) * STREAM_SEGMENT_SIZE);
+            if (stream.segments[segment] == NULL) {
+                return false;
+            }
+        }
+        *STREAM_CHUNK(*loaded) = pack_chunk(cmds + i * COMMANDS_PER_CHUNK);
+    }
+    return true;
+}
+
+/* Makes the chunks read so far available to the interpreter, along with how
+   the reader ended up if it's finished */
+void publish_chunks(size_t loaded, enum StreamState state) {
+    pthread_mutex_lock(&stream.lock);
+    stream.loaded = loaded;
+    stream.state = state;
+    pthread_cond_broadcast(&stream.arrived);
+    pthread_mutex_unlock(&stream.lock);
+}
+
+/* Reads, checks and decodes the program a block at a time. Commands that
+   don't make up a whole chunk yet are held over to the next block */
+void *read_stream(void *arg) {
+    static unsigned char text[STREAM_BLOCK_SIZE];
+    static unsigned char cmds[STREAM_BLOCK_SIZE + COMMANDS_PER_CHUNK];
+    size_t pending = 0, loaded = 0;
+
+    (void) arg;
+    while (true) {
+        ssize_t n = read(stream.fd, text, sizeof(text));
+        size_t count, bad;
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n <= 0) {
+            break;
+        }
+
+        count = pending + scan_commands(text, n, cmds + pending, &bad);
+        if (!store_chunks(cmds, count / COMMANDS_PER_CHUNK, &loaded)) {
+            publish_chunks(loaded, STREAM_NO_MEMORY);
+            return NULL;
+        }
+        pending = count % COMMANDS_PER_CHUNK;
+        memmove(cmds, cmds + count - pending, pending);
+
+        if (bad < (size_t) n) {
+            stream.bad_char = text[bad];
+            publish_chunks(loaded, STREAM_BAD_CHARACTER);
+            return NULL;
+        }
+        publish_chunks(loaded, STREAM_LOADING);
+    }
+    publish_chunks(loaded, pending == 0 ? STREAM_DONE : STREAM_BAD_LENGTH);
+    return NULL;
+}
+
+/* Stops the reader and frees the chunks it read */
+void free_stream() {
+    size_t i;
+
+    if (stream.started) {
+        pthread_cancel(stream.reader);
+        pthread_join(stream.reader, NULL);
+    }
+    close(stream.fd);
+    for (i = 0; i < MAX_STREAM_SEGMENTS && stream.segments[i] != NULL; i++) {
+        free(stream.segments[i]);
+    }
+}
+
+void start_stream(const char *filename) {
+    stream.fd = open(filename, O_RDONLY);
+    if (stream.fd < 0) {
+        fprintf(stderr, "Error! Unable to open %s!\n", filename);
+        exit(1);
+    }
+    init_scanner();
+    atexit(free_stream);
+
+    /* Without a thread to read it, the whole program is read up front */
+    stream.started =
+        pthread_create(&stream.reader, NULL, read_stream, NULL) == 0;
+    if (!stream.started) {
+        read_stream(NULL);
+    }
+}
+
+/* Waits until the reader has read the given chunk. If it never will, the
+   error that stopped it is reported, which for a program that was read
+   without any is the chunk not existing */
+uint32_t *wait_for_chunk(size_t index) {
+    enum StreamState state;
+
+    pthread_mutex_lock(&stream.lock);
+    while (stream.loaded <= index && stream.state == STREAM_LOADING) {
+        pthread_cond_wait(&stream.arrived, &stream.lock);
+    }
+    available = stream.loaded;
+    state = stream.state;
+    pthread_mutex_unlock(&stream.lock);
+
+    if (index < available) {
+        return STREAM_CHUNK(index);
+    }
+    switch (state) {
+        case STREAM_BAD_CHARACTER:
+            report_bad_character(stream.bad_char);
+            break;
+        case STREAM_BAD_LENGTH:
+            fprintf(stderr, "Error! Inadequate code length!\n");
+            break;
+        case STREAM_NO_MEMORY:
+            fprintf(stderr, "Error! Unable to allocate additional "
+                            "space for the code!\n");
+            break;
+        default:
+            fprintf(stderr, "Error! Cannot go to nonexistent chunk %zu!\n",
+                    index);
+            break;
+    }
+    exit(1);
+}
+
+/* Returns a streamed chunk, only waiting on the reader if it hasn't been
+   seen to arrive yet */
+static inline uint32_t *stream_chunk(size_t index) {
+    return index < available ? STREAM_CHUNK(index) : wait_for_chunk(index);
+}
+
+void run_stream_engine() {
+    uint32_t *chunk = stream_chunk(0);
+
+    while (true) {
+        execute_chunk(*chunk, CHUNK_IS_VISITED(*chunk));
+        *chunk |= CHUNK_VISITED;
+        if (stack_size == 0) {
+            fprintf(stderr, "Error! Can't have an empty stack upon reaching "
+                            "the end of a chunk!\n");
+            exit(1);
+        }
+        chunk = stream_chunk(STACK_TOP);
+    }
+}
@@ -0,0 +1,143 @@
+/* Generated by xrf --superinstructions from 1 program. Run
+   make superinstructions to generate it again rather than editing it */
+
+#include "xrf.h"
+
+static unsigned int super_0(unsigned int tos) {
+    tos = tos + 1;
+    tos = swap_cached(tos);
+    return tos;
+}
+
+static unsigned int super_1(unsigned int tos) {
+    tos = tos + 1;
+    tos = swap_cached(tos);
+    tos = dup_cached(tos);
+    tos = add_cached(tos);
+    tos = swap_cached(tos);
+    return tos;
+}
+
+static unsigned int super_2(unsigned int tos) {
+    tos = tos + 1;
+    tos = swap_cached(tos);
+    tos = dup_cached(tos);
+    return tos;
+}
+
+static unsigned int super_3(unsigned int tos) {
+    tos = tos + 1;
+    tos = swap_cached(tos);
+    tos = dup_cached(tos);
+    tos = output_cached(tos);
+    tos = swap_cached(tos);
+    return tos;
+}
+
+static unsigned int super_4(unsigned int tos) {
+    tos = swap_cached(tos);
+    tos = dup_cached(tos);
+    tos = add_cached(tos);
+    tos = swap_cached(tos);
+    return tos;
+}
+
+static unsigned int super_5(unsigned int tos) {
+    tos = tos + 1;
+    tos = swap_cached(tos);
+    tos = dup_cached(tos);
+    tos = add_cached(tos);
+    return tos;
+}
+
+static unsigned int super_6(unsigned int tos) {
+    tos = swap_cached(tos);
+    tos = dup_cached(tos);
+    tos = output_cached(tos);
+    tos = swap_cached(tos);
+    return tos;
+}
+
+static unsigned int super_7(unsigned int tos) {
+    tos = tos + 1;
+    tos = swap_cached(tos);
+    tos = dup_cached(tos);
+    tos = output_cached(tos);
+    return tos;
+}
+
+static unsigned int super_8(unsigned int tos) {
+    tos = dup_cached(tos);
+    tos = add_cached(tos);
+    tos = swap_cached(tos);
+    return tos;
+}
+
+static unsigned int super_9(unsigned int tos) {
+    tos = swap_cached(tos);
+    tos = dup_cached(tos);
+    tos = add_cached(tos);
+    return tos;
+}
+
+static unsigned int super_10(unsigned int tos) {
+    tos = swap_cached(tos);
+    tos = dup_cached(tos);
+    return tos;
+}
+
+static unsigned int super_11(unsigned int tos) {
+    tos = dup_cached(tos);
+    tos = output_cached(tos);
+    tos = swap_cached(tos);
+    return tos;
+}
+
+static unsigned int super_12(unsigned int tos) {
+    tos = swap_cached(tos);
+    tos = dup_cached(tos);
+    tos = output_cached(tos);
+    return tos;
+}
+
+static unsigned int super_13(unsigned int tos) {
+    tos = tos + 1;
+    tos = swap_cached(tos);
+    tos = tos + 1;
+    tos = swap_cached(tos);
+    return tos;
+}
+
+static unsigned int super_14(unsigned int tos) {
+    tos = tos + 1;
+    tos = swap_cached(tos);
+    tos = tos + 1;
+    return tos;
+}
+
+static unsigned int super_15(unsigned int tos) {
+    tos = dup_cached(tos);
+    tos = add_cached(tos);
+    return tos;
+}
+
+const struct Superinstruction SUPERINSTRUCTIONS[] = {
+    { { OP_INC, OP_SWAP }, 2, super_0 },
+    { { OP_INC, OP_SWAP, OP_DUP, OP_ADD, OP_SWAP }, 5, super_1 },
+    { { OP_INC, OP_SWAP, OP_DUP }, 3, super_2 },
+    { { OP_INC, OP_SWAP, OP_DUP, OP_OUTPUT, OP_SWAP }, 5, super_3 },
+    { { OP_SWAP, OP_DUP, OP_ADD, OP_SWAP }, 4, super_4 },
+    { { OP_INC, OP_SWAP, OP_DUP, OP_ADD }, 4, super_5 },
+    { { OP_SWAP, OP_DUP, OP_OUTPUT, OP_SWAP }, 4, super_6 },
+    { { OP_INC, OP_SWAP, OP_DUP, OP_OUTPUT }, 4, super_7 },
+    { { OP_DUP, OP_ADD, OP_SWAP }, 3, super_8 },
+    { { OP_SWAP, OP_DUP, OP_ADD }, 3, super_9 },
+    { { OP_SWAP, OP_DUP }, 2, super_10 },
+    { { OP_DUP, OP_OUTPUT, OP_SWAP }, 3, super_11 },
+    { { OP_SWAP, OP_DUP, OP_OUTPUT }, 3, super_12 },
+    { { OP_INC, OP_SWAP, OP_INC, OP_SWAP }, 4, super_13 },
+    { { OP_INC, OP_SWAP, OP_INC }, 3, super_14 },
+    { { OP_DUP, OP_ADD }, 2, super_15 }
+};
+
+const size_t NUM_SUPERINSTRUCTIONS = 16;
@@ -0,0 +1,202 @@
+#include <string.h>
+
+#include "xrf.h"
+
+/* The most superinstructions that get generated */
+#define MAX_GENERATED_SUPERINSTRUCTIONS 16
+
+/* How many sequences of each length can be made of the ops in SUPER_INDEX,
+   which is NUM_SUPER_OPS to the power of the length */
+static const size_t NUM_SEQUENCES[COMMANDS_PER_CHUNK + 1] = {
+    1,
+    NUM_SUPER_OPS,
+    NUM_SUPER_OPS * NUM_SUPER_OPS,
+    NUM_SUPER_OPS * NUM_SUPER_OPS * NUM_SUPER_OPS,
+    NUM_SUPER_OPS * NUM_SUPER_OPS * NUM_SUPER_OPS * NUM_SUPER_OPS,
+    NUM_SUPER_OPS * NUM_SUPER_OPS * NUM_SUPER_OPS * NUM_SUPER_OPS
+    * NUM_SUPER_OPS
+};
+
+/* The name of each op that can be part of a superinstruction, and the C
+   expression that runs it on the cached top of the stack, like the threaded
+   cores do */
+const char *const SUPER_OP_NAMES[NUM_OPS] = {
+    [OP_INPUT] = "OP_INPUT",
+    [OP_OUTPUT] = "OP_OUTPUT",
+    [OP_POP] = "OP_POP",
+    [OP_DUP] = "OP_DUP",
+    [OP_SWAP] = "OP_SWAP",
+    [OP_INC] = "OP_INC",
+    [OP_DEC] = "OP_DEC",
+    [OP_ADD] = "OP_ADD",
+    [OP_SUB] = "OP_SUB"
+};
+
+const char *const SUPER_OP_ACTIONS[NUM_OPS] = {
+    [OP_INPUT] = "input_cached(tos)",
+    [OP_OUTPUT] = "output_cached(tos)",
+    [OP_POP] = "pop_cached()",
+    [OP_DUP] = "dup_cached(tos)",
+    [OP_SWAP] = "swap_cached(tos)",
+    [OP_INC] = "tos + 1",
+    [OP_DEC] = "dec_cached(tos)",
+    [OP_ADD] = "add_cached(tos)",
+    [OP_SUB] = "sub_cached(tos)"
+};
+
+/* How many times each sequence of ops appears in the corpus, indexed by its
+   length and then by the positions of its ops in SUPER_INDEX as the digits
+   of a number */
+static unsigned long *sequence_counts[COMMANDS_PER_CHUNK + 1];
+
+/* Returns the op at a position in SUPER_INDEX */
+unsigned char super_op(unsigned index) {
+    unsigned char op;
+
+    for (op = 0; SUPER_INDEX[op] != index + 1; op++);
+    return op;
+}
+
+/* Counts every sequence of two or more ops that could be a superinstruction
+   in the variants of every chunk of the loaded program. Sequences are
+   counted once per chunk they appear in, since the chunks that share a body
+   are each run on their own */
+void count_sequences() {
+    struct FusedOp fused[COMMANDS_PER_CHUNK];
+    size_t i;
+    unsigned v, start, end, len;
+
+    for (i = 0; i < code.num_chunks; i++) {
+        size_t unique = CHUNK_UNIQUE(code.chunks[i]);
+
+        for (v = 0; v < 2; v++) {
+            len = lower_variant(&code.variants[unique * 2 + v], fused);
+            for (start = 0; start < len; start++) {
+                size_t number = 0;
+
+                for (end = start; end < len; end++) {
+                    if (fused[end].count > 1
+                        || SUPER_INDEX[fused[end].op] == 0)
+                    {
+                        break;
+                    }
+                    number = number * NUM_SUPER_OPS
+                             + SUPER_INDEX[fused[end].op] - 1;
+                    if (end > start) {
+                        sequence_counts[end - start + 1][number]++;
+                    }
+                }
+            }
+        }
+    }
+}
+
+/* Picks the sequence that saves the most dispatches over the corpus, which
+   is how often it appears times one less than its length, and clears its
+   count. Returns false if there are none left */
+bool pick_sequence(unsigned *len, size_t *number) {
+    unsigned long best = 0;
+    unsigned l;
+    size_t n;
+
+    for (l = 2; l <= COMMANDS_PER_CHUNK; l++) {
+        for (n = 0; n < NUM_SEQUENCES[l]; n++) {
+            if (sequence_counts[l][n] * (l - 1) > best) {
+                best = sequence_counts[l][n] * (l - 1);
+                *len = l;
+                *number = n;
+            }
+        }
+    }
+    if (best == 0) {
+        return false;
+    }
+    sequence_counts[*len][*number] = 0;
+    return true;
+}
+
+/* Writes out the handler of a sequence, and fills ops with its ops */
+void emit_superinstruction(FILE *out, unsigned index, unsigned len,
+                           size_t number, unsigned char *ops)
+{
+    unsigned i;
+
+    for (i = len; i-- > 0;) {
+        ops[i] = super_op(number % NUM_SUPER_OPS);
+        number /= NUM_SUPER_OPS;
+    }
+    fprintf(out, "\nstatic unsigned int super_%u(unsigned int tos) {\n",
+            index);
+    for (i = 0; i < len; i++) {
+        fprintf(out, "    tos = %s;\n", SUPER_OP_ACTIONS[ops[i]]);
+    }
+    fprintf(out, "    return tos;\n");
+    fprintf(out, "}\n");
+}
+
+void write_superinstructions(const char **files, size_t num_files,
+                             const char *output_name)
+{
+    unsigned char ops[MAX_GENERATED_SUPERINSTRUCTIONS][COMMANDS_PER_CHUNK];
+    unsigned char lens[MAX_GENERATED_SUPERINSTRUCTIONS];
+    unsigned num_picked = 0, len, i, j;
+    size_t number, f;
+    FILE *out;
+
+    for (len = 2; len <= COMMANDS_PER_CHUNK; len++) {
+        sequence_counts[len] = calloc(NUM_SEQUENCES[len],
+                                      sizeof(unsigned long));
+        if (sequence_counts[len] == NULL) {
+            fprintf(stderr, "Error! Unable to allocate space for the "
+                            "superinstructions!\n");
+            exit(1);
+        }
+    }
+    for (f = 0; f < num_files; f++) {
+        read_xrf_file(files[f]);
+        count_sequences();
+        free_xrf_code();
+        memset(&code, 0, sizeof(code));
+    }
+
+    out = output_name != NULL ? fopen(output_name, "w") : stdout;
+    if (out == NULL) {
+        fprintf(stderr, "Error! Unable to open %s!\n", output_name);
+        exit(1);
+    }
+    fprintf(out, "/* Generated by xrf --superinstructions from %zu "
+                 "program%s. Run\n   make superinstructions to generate it "
+                 "again rather than editing it */\n\n",
+            num_files, num_files == 1 ? "" : "s");
+    fprintf(out, "#include \"xrf.h\"\n");
+    while (num_picked < MAX_GENERATED_SUPERINSTRUCTIONS
+           && pick_sequence(&len, &number))
+    {
+        emit_superinstruction(out, num_picked, len, number, ops[num_picked]);
+        lens[num_picked++] = len;
+    }
+
+    fprintf(out, "\nconst struct Superinstruction SUPERINSTRUCTIONS[] = {\n");
+    for (i = 0; i < num_picked; i++) {
+        fprintf(out, "    { { ");
+        for (j = 0; j < lens[i]; j++) {
+            fprintf(out, "%s%s", j > 0 ? ", " : "",
+                    SUPER_OP_NAMES[ops[i][j]]);
+        }
+        fprintf(out, " }, %u, super_%u }%s\n", lens[i], i,
+                i + 1 < num_picked ? "," : "");
+    }
+    if (num_picked == 0) {
+        fprintf(out, "    { { 0 }, 0, NULL }\n");
+    }
+    fprintf(out, "};\n\n");
+    fprintf(out, "const size_t NUM_SUPERINSTRUCTIONS = %u;\n", num_picked);
+
+    if ((output_name != NULL ? fclose(out) : fflush(out)) != 0) {
+        fprintf(stderr, "Error! Unable to write the superinstructions!\n");
+        exit(1);
+    }
+    for (len = 2; len <= COMMANDS_PER_CHUNK; len++) {
+        free(sequence_counts[len]);
+    }
+}
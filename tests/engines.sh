@@ -0,0 +1,55 @@
+#!/bin/sh
+# Runs hello_world.xrf and the programs in tests/programs through every
+# engine and --stream, and checks that their output, errors and exit status
+# are the same as the switch core's. A program's input is read from the .in
+# file next to it, if it has one. Engines this build doesn't have are
+# skipped. Run by make test from the top directory
+
+cd "$(dirname "$0")/.." || exit 1
+
+work=$(mktemp -d) || exit 1
+trap 'rm -rf "$work"' EXIT
+
+# The native engine caches the code it compiles in here
+XDG_CACHE_HOME=$work/cache
+export XDG_CACHE_HOME
+
+# Runs a program with the given options, leaving what it did in the files
+# starting with $work/$1
+run() {
+    name=$1
+    program=$2
+    shift 2
+    input=${program%.xrf}.in
+    [ -f "$input" ] || input=/dev/null
+    ./xrf "$@" "$program" < "$input" \
+        > "$work/$name.stdout" 2> "$work/$name.stderr"
+    echo $? > "$work/$name.status"
+}
+
+failures=0
+cases=0
+for program in hello_world.xrf tests/programs/*.xrf; do
+    run expected "$program" --engine=switch
+    for options in --engine=goto --engine=tail --engine=jit \
+                   --engine=native --stream; do
+        run actual "$program" $options
+        if grep -q "Unknown engine" "$work/actual.stderr"; then
+            continue
+        fi
+        cases=$((cases + 1))
+        for part in stdout stderr status; do
+            if ! cmp -s "$work/expected.$part" "$work/actual.$part"; then
+                echo "$program ($options): $part differs" >&2
+                failures=$((failures + 1))
+                break
+            fi
+        done
+    done
+done
+
+if [ $failures -gt 0 ]; then
+    echo "$failures of $cases engine cases failed" >&2
+    exit 1
+fi
+echo "All $cases engine cases passed"
@@ -0,0 +1,67 @@
+#include "../xrf.h"
+
+/* Checks the exit_delta that the load-time analysis finds for the variants
+   of single chunks. Built and run by make test */
+
+struct ExitDeltaCase {
+    const char *chunk; /* The five commands of the chunk */
+    bool visited; /* Which of its variants is checked */
+    int exit_delta; /* What the analysis should find */
+};
+
+const struct ExitDeltaCase CASES[] = {
+    /* The index only goes up */
+    { "5FFFF", false, 1 },
+    { "555AF", true, 3 },
+    { "8555A", false, 2 },
+    { "8555A", true, 3 },
+    { "56AFF", false, 0 },
+    { "556AF", false, 1 },
+
+    /* The index is swapped below the top and back up again, as in the
+       bodies hello_world.xrf uses to step to the next chunk */
+    { "54374", false, 1 },
+    { "54554", false, 1 },
+    { "54664", false, 1 },
+    { "54314", false, 1 },
+    { "44AFF", false, 0 },
+
+    /* Something else ends up on top */
+    { "4AFFF", false, EXIT_DYNAMIC },
+    { "0AFFF", false, EXIT_DYNAMIC },
+    { "2AFFF", false, EXIT_DYNAMIC },
+    { "37AFF", false, EXIT_DYNAMIC },
+    { "6AFFF", false, EXIT_DYNAMIC },
+
+    /* The index is still on top, but the stack was shuffled or the program
+       ends */
+    { "9AFFF", false, EXIT_DYNAMIC },
+    { "D4DAF", false, EXIT_DYNAMIC },
+    { "5BFFF", false, EXIT_DYNAMIC }
+};
+
+int main() {
+    size_t i, failures = 0;
+
+    for (i = 0; i < sizeof(CASES) / sizeof(*CASES); i++) {
+        struct Variant variant;
+
+        compile_variant(&variant,
+                        pack_chunk((const unsigned char *) CASES[i].chunk),
+                        CASES[i].visited);
+        if (variant.exit_delta != CASES[i].exit_delta) {
+            fprintf(stderr, "%s (%s): expected exit_delta %d, got %d\n",
+                    CASES[i].chunk, CASES[i].visited ? "revisit" : "first",
+                    CASES[i].exit_delta, variant.exit_delta);
+            failures++;
+        }
+    }
+    if (failures > 0) {
+        fprintf(stderr, "%zu of %zu exit_delta cases failed\n", failures,
+                sizeof(CASES) / sizeof(*CASES));
+        return 1;
+    }
+    printf("All %zu exit_delta cases passed\n",
+           sizeof(CASES) / sizeof(*CASES));
+    return 0;
+}
@@ -0,0 +1,297 @@
+#include <string.h>
+
+#include "../xrf.h"
+
+/* Checks the IR that variants are lifted into, and the ops that
+   lower_variant lowers them to. The shape of the IR is checked for chunks
+   whose ops fold or are stripped, and then for a sample of chunk bodies, the
+   IR and the lowered ops are each run on the same stack and input as the
+   variant's own ops and have to do the same. Built and run by make test */
+
+struct ShapeCase {
+    const char *chunk; /* The five commands of the chunk */
+    unsigned num_segments; /* How many segments its first-visit variant has */
+    unsigned consumed, depth; /* What its first segment takes and leaves */
+    unsigned live; /* How many instructions of that segment are live */
+};
+
+const struct ShapeCase SHAPES[] = {
+    /* Values put back in the cells they came from are stripped */
+    { "32FFF", 1, 0, 0, 0 },
+    { "44FFF", 1, 0, 0, 0 },
+    { "4444F", 1, 0, 0, 0 },
+    { "34FFF", 1, 0, 1, 1 },
+
+    /* Values that are only popped are dead */
+    { "5222F", 1, 3, 0, 0 },
+    { "53E2F", 1, 1, 0, 0 },
+
+    /* Runs of increments and of decrements fold into one instruction, but
+       not into each other */
+    { "555FF", 1, 1, 1, 2 },
+    { "666FF", 1, 1, 1, 2 },
+    { "56FFF", 1, 1, 1, 3 },
+
+    /* A value's difference with itself is a constant, which folds too */
+    { "3EFFF", 1, 1, 1, 1 },
+    { "3E55F", 1, 1, 1, 1 },
+    { "37FFF", 1, 1, 1, 2 },
+
+    /* Input and output are always live */
+    { "02FFF", 1, 0, 0, 1 },
+    { "31FFF", 1, 0, 0, 2 },
+
+    /* Ops that need the whole stack split the variant into segments */
+    { "59D6F", 3, 1, 1, 2 },
+    { "9FFFF", 2, 0, 0, 0 }
+};
+
+/* How many chunk bodies are run, and the seed they're picked with */
+#define SAMPLE_BODIES 20000
+#define SAMPLE_SEED 12345
+
+/* How many values are on the stack below what a variant needs */
+#define EXTRA_DEPTH 2
+
+/* The values the stack is filled with, which include the ones that
+   decrements stop at and increments wrap around */
+const unsigned int STACK_VALUES[] = { 0, 1, 2, 3, 7, 200, 65536, 0xFFFFFFFF };
+
+/* The input the variants read from, which is never used up */
+const unsigned char INPUT_TEXT[] = "A\0z\n\377Q7x";
+
+/* What running a variant did */
+struct RunResult {
+    unsigned int stack[64];
+    size_t depth;
+    unsigned char out[COMMANDS_PER_CHUNK];
+    size_t out_len;
+    size_t read;
+};
+
+/* Sets the stack, input and output up for a run, with the stack holding
+   depth values taken from start */
+void start_run(const unsigned int *start, size_t depth) {
+    size_t i;
+
+    stack.head = 40;
+    stack_size = depth;
+    for (i = 0; i < depth; i++) {
+        STACK_AT(i) = start[i];
+    }
+    input.pos = INPUT_TEXT;
+    input.end = INPUT_TEXT + sizeof(INPUT_TEXT) - 1;
+    output.len = 0;
+    output.limit = OUTPUT_BUFFER_SIZE;
+    output.flush_char = -1;
+    srand(SAMPLE_SEED);
+}
+
+void finish_run(struct RunResult *result) {
+    size_t i;
+
+    result->depth = stack_size;
+    for (i = 0; i < stack_size; i++) {
+        result->stack[i] = STACK_AT(i);
+    }
+    memcpy(result->out, output.buf, output.len);
+    result->out_len = output.len;
+    result->read = input.pos - INPUT_TEXT;
+}
+
+/* Runs a lifted variant the way the backends do: the live instructions of
+   each segment are worked out apart from the stack, the values it leaves
+   that aren't already in place are stored, and the ops that need the whole
+   stack run between the segments. Values that aren't live are left as
+   garbage, so that any that end up used show */
+void run_ir(const struct IrVariant *ir) {
+    unsigned s, i;
+
+    for (s = 0; s < ir->num_segments; s++) {
+        const struct IrSegment *seg = &ir->segments[s];
+        unsigned int vals[IR_MAX_INSTS];
+        int shift = seg->consumed - seg->depth, c;
+
+        for (i = 0; i < seg->num_insts; i++) {
+            const struct IrInst *inst = &seg->insts[i];
+            unsigned int a, b;
+
+            vals[i] = 0xDEADBEEF;
+            if (!inst->live) {
+                continue;
+            }
+            a = vals[inst->a];
+            b = vals[inst->b];
+            switch (inst->op) {
+                case IR_LOAD:
+                    vals[i] = STACK_AT(inst->imm);
+                    break;
+                case IR_CONST:
+                    vals[i] = inst->imm;
+                    break;
+                case IR_INPUT:
+                    c = read_input();
+                    vals[i] = c == EOF ? 0 : (unsigned) c;
+                    break;
+                case IR_OUTPUT:
+                    write_output(a);
+                    break;
+                case IR_ADD:
+                    vals[i] = a + b;
+                    break;
+                case IR_ADD_IMM:
+                    vals[i] = a + inst->imm;
+                    break;
+                case IR_SUB_SAT:
+                    vals[i] = a > inst->imm ? a - inst->imm : 0;
+                    break;
+                case IR_DIFF:
+                    vals[i] = a > b ? a - b : b - a;
+                    break;
+            }
+        }
+        for (i = 0; i < seg->depth; i++) {
+            if (!ir_in_place(seg, i)) {
+                STACK_AT(shift + (int) i) =
+                    vals[seg->stack[seg->depth - 1 - i]];
+            }
+        }
+        stack.head = (stack.head + shift) & stack.mask;
+        stack_size -= shift;
+
+        if (seg->barrier == OP_BOTTOM) {
+            send_top_to_bottom();
+        } else if (seg->barrier == OP_RANDOMIZE) {
+            randomize_stack();
+        }
+    }
+}
+
+/* Runs the ops a variant is lowered to, with each run of ops repeated */
+void run_lowered(const struct Variant *variant) {
+    struct FusedOp fused[COMMANDS_PER_CHUNK];
+    struct Variant lowered;
+    unsigned i, j, len = lower_variant(variant, fused);
+
+    lowered.len = 0;
+    for (i = 0; i < len; i++) {
+        for (j = 0; j < fused[i].count; j++) {
+            lowered.ops[lowered.len++] = fused[i].op;
+        }
+    }
+    execute_variant(&lowered);
+}
+
+bool same_result(const struct RunResult *a, const struct RunResult *b) {
+    return a->depth == b->depth && a->out_len == b->out_len
+           && a->read == b->read
+           && memcmp(a->stack, b->stack, sizeof(*a->stack) * a->depth) == 0
+           && memcmp(a->out, b->out, a->out_len) == 0;
+}
+
+/* Checks the shape of the IR of the first-visit variant of a chunk */
+bool check_shape(const struct ShapeCase *shape) {
+    struct Variant variant;
+    struct IrVariant ir;
+    const struct IrSegment *seg = &ir.segments[0];
+    unsigned i, live = 0;
+
+    compile_variant(&variant, pack_chunk((const unsigned char *) shape->chunk),
+                    false);
+    lift_variant(&variant, &ir);
+    for (i = 0; i < seg->num_insts; i++) {
+        live += seg->insts[i].live;
+    }
+    if (ir.num_segments != shape->num_segments
+        || seg->consumed != shape->consumed || seg->depth != shape->depth
+        || live != shape->live)
+    {
+        fprintf(stderr, "%s: expected %u segments, the first taking %u, "
+                        "leaving %u and with %u live, got %u, %u, %u, %u\n",
+                shape->chunk, shape->num_segments, shape->consumed,
+                shape->depth, shape->live, ir.num_segments, seg->consumed,
+                seg->depth, live);
+        return false;
+    }
+    return true;
+}
+
+/* A linear congruential generator for the bodies and the stacks they run
+   on, since the runs reseed rand for the randomize op */
+uint32_t next_random(uint32_t *state) {
+    *state = *state * 1103515245 + 12345;
+    return *state >> 8;
+}
+
+/* Runs a variant of a chunk body as it is, as lifted, and as lowered, and
+   checks that they all do the same */
+bool check_variant(uint32_t body, bool visited, uint32_t *state) {
+    static struct RunResult expected, actual;
+    unsigned int start[COMMANDS_PER_CHUNK * 2 + EXTRA_DEPTH];
+    struct Variant variant;
+    struct IrVariant ir;
+    size_t i, depth;
+    bool same;
+
+    compile_variant(&variant, body, visited);
+    for (i = 0; i < variant.len; i++) {
+        if (variant.ops[i] == OP_EXIT) {
+            return true;
+        }
+    }
+    depth = variant.min_depth + EXTRA_DEPTH;
+    for (i = 0; i < depth; i++) {
+        start[i] = STACK_VALUES[next_random(state)
+                                % (sizeof(STACK_VALUES)
+                                   / sizeof(*STACK_VALUES))];
+    }
+
+    start_run(start, depth);
+    execute_variant(&variant);
+    finish_run(&expected);
+
+    lift_variant(&variant, &ir);
+    start_run(start, depth);
+    run_ir(&ir);
+    finish_run(&actual);
+    same = same_result(&expected, &actual);
+
+    start_run(start, depth);
+    run_lowered(&variant);
+    finish_run(&actual);
+    if (!same || !same_result(&expected, &actual)) {
+        fprintf(stderr, "%05X (%s): the %s doesn't match the ops\n",
+                (unsigned) body, visited ? "revisit" : "first",
+                same ? "lowered ops" : "IR");
+        return false;
+    }
+    return true;
+}
+
+int main() {
+    size_t i, checked = 0, failures = 0;
+    uint32_t state = SAMPLE_SEED;
+
+    for (i = 0; i < sizeof(SHAPES) / sizeof(*SHAPES); i++) {
+        failures += !check_shape(&SHAPES[i]);
+        checked++;
+    }
+
+    stack.vals = malloc(sizeof(unsigned int) * 64);
+    stack.mask = 63;
+    for (i = 0; i < SAMPLE_BODIES; i++) {
+        uint32_t body = next_random(&state) & (CHUNK_VISITED - 1);
+
+        failures += !check_variant(body, false, &state);
+        failures += !check_variant(body, true, &state);
+        checked += 2;
+    }
+    free(stack.vals);
+
+    if (failures > 0) {
+        fprintf(stderr, "%zu of %zu IR cases failed\n", failures, checked);
+        return 1;
+    }
+    printf("All %zu IR cases passed\n", checked);
+    return 0;
+}
@@ -0,0 +1,156 @@
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../xrf.h"
+
+/* Checks that loading a program split into several ranges gives the same
+   chunks, or the same error, as loading it as one range does, which is how
+   it's loaded on a single thread. Built and run by make test */
+
+/* The numbers of ranges each program is loaded with */
+const size_t RANGE_COUNTS[] = { 2, 3, 7, 64 };
+
+/* How much a loaded program can print */
+#define LOAD_RESULT_SIZE (1 << 16)
+
+/* What loading a program did */
+struct LoadResult {
+    char out[LOAD_RESULT_SIZE]; /* The packed chunks, or the error */
+    size_t len;
+    int status;
+};
+
+/* Loads text in a child process, since errors exit, and collects the body
+   of every chunk it loaded, or the error it stopped with */
+void load_in_child(const unsigned char *text, size_t len, size_t num_ranges,
+                   struct LoadResult *result)
+{
+    int fds[2];
+    pid_t pid;
+    ssize_t n;
+
+    if (pipe(fds) != 0 || (pid = fork()) < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        unsigned char *cmds = malloc(len > 0 ? len : 1);
+        size_t i;
+
+        dup2(fds[1], STDOUT_FILENO);
+        dup2(fds[1], STDERR_FILENO);
+        close(fds[0]);
+        init_scanner();
+        load_program(text, len, cmds, num_ranges);
+        for (i = 0; i < code.num_chunks; i++) {
+            printf("%05X\n", (unsigned) CHUNK_BODY(code.chunks[i]));
+        }
+        exit(0);
+    }
+
+    close(fds[1]);
+    result->len = 0;
+    while (result->len < LOAD_RESULT_SIZE
+           && (n = read(fds[0], result->out + result->len,
+                        LOAD_RESULT_SIZE - result->len)) > 0)
+    {
+        result->len += n;
+    }
+    close(fds[0]);
+    waitpid(pid, &result->status, 0);
+}
+
+/* Loads text with one range and then with each count of ranges, returning
+   how many of them didn't match */
+size_t check_program(const char *name, const unsigned char *text, size_t len)
+{
+    static struct LoadResult serial, split;
+    size_t i, failures = 0;
+
+    load_in_child(text, len, 1, &serial);
+    for (i = 0; i < sizeof(RANGE_COUNTS) / sizeof(*RANGE_COUNTS); i++) {
+        load_in_child(text, len, RANGE_COUNTS[i], &split);
+        if (split.status != serial.status || split.len != serial.len
+            || memcmp(split.out, serial.out, serial.len) != 0)
+        {
+            fprintf(stderr, "%s: loading with %zu ranges differs from loading"
+                            " with one\n", name, RANGE_COUNTS[i]);
+            failures++;
+        }
+    }
+    return failures;
+}
+
+/* Fills text with a made-up program of len bytes, with commands and runs of
+   every kind of whitespace between them */
+void make_program(unsigned char *text, size_t len, unsigned seed) {
+    static const char WHITESPACE[] = " \t\n\v\f\r";
+    size_t i;
+
+    srand(seed);
+    for (i = 0; i < len; i++) {
+        if (rand() % 3 == 0) {
+            text[i] = WHITESPACE[rand() % (sizeof(WHITESPACE) - 1)];
+        } else {
+            text[i] = "0123456789ABCDEF"[rand() % 16];
+        }
+    }
+}
+
+int main() {
+    static unsigned char text[4096];
+    size_t i, len, count, checked = 0, failures = 0;
+    unsigned seed;
+    FILE *file = fopen("hello_world.xrf", "rb");
+
+    if (file == NULL) {
+        fprintf(stderr, "Unable to open hello_world.xrf\n");
+        return 1;
+    }
+    len = fread(text, 1, sizeof(text), file);
+    fclose(file);
+    failures += check_program("hello_world.xrf", text, len);
+    checked++;
+
+    for (seed = 0; seed < 32; seed++) {
+        len = 100 + seed * 97;
+        make_program(text, len, seed);
+        count = 0;
+        for (i = 0; i < len; i++) {
+            count += decode_command(text[i]) >= 0;
+        }
+
+        /* Alternately a program of whole chunks, and one with commands left
+           over at the end */
+        while ((count % COMMANDS_PER_CHUNK == 0) != (seed % 2 == 0)) {
+            text[len++] = '5';
+            count++;
+        }
+        failures += check_program("whole chunks", text, len);
+
+        /* A bad character is reported for the first one in the text, even
+           when there's a different one in a later range, and before the
+           length is checked */
+        text[len * 2 / 3] = 'x';
+        failures += check_program("a bad character", text, len);
+        text[len / 5 + seed] = 'G';
+        failures += check_program("two bad characters", text, len);
+        checked += 3;
+    }
+
+    /* Programs shorter than the number of ranges leave some of them empty */
+    failures += check_program("a short program", (const unsigned char *)
+                              "5AFFF", 5);
+    failures += check_program("an empty program", text, 0);
+    checked += 2;
+
+    if (failures > 0) {
+        fprintf(stderr, "%zu of %zu load cases failed\n", failures,
+                checked * (sizeof(RANGE_COUNTS) / sizeof(*RANGE_COUNTS)));
+        return 1;
+    }
+    printf("All %zu load cases passed\n",
+           checked * (sizeof(RANGE_COUNTS) / sizeof(*RANGE_COUNTS)));
+    return 0;
+}
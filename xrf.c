@@ -1,346 +1,1784 @@
-#include <ctype.h>
-#include <stdbool.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <time.h>
-
-const unsigned int COMMANDS_PER_CHUNK = 5;
-
-/* A struct for each node of the stack */
-struct Stack {
-    unsigned int val; /* The value held by this node */
-    struct Stack *next, *prev; /* Pointer to the next and previous node */
-} *top, *bottom;
-
-int stack_size = 1;
-
-/* A struct for keeping track of the read-in XRF code */
-struct Code {
-    char *commands; /* Array of all the commands */
-    bool *visited; /* Array of whether each chunk has been visited yet */
-    int len; /* How many commands there are */
-} code;
-
-/* Returns a pointer to a newly-malloc'd node with a value of val */
-struct Stack *new_stack_node(int val) {
-    struct Stack *node = malloc(sizeof(struct Stack));
-    if (node == NULL) {
-        fprintf(stderr, "Error! Unable to allocate additional stack space!\n");
-        exit(1);
-    }
-    node->next = NULL;
-    node->prev = NULL;
-    node->val = val;
-    return node;
-}
-
-/* Frees the stack */
-void free_stack() {
-    struct Stack *temp;
-    while (bottom != NULL) {
-        temp = bottom;
-        bottom = bottom->prev;
-        free(temp);
-    }
-}
-
-/* Pushes a new node onto the stack */
-void push_stack(int val) {
-    if (top->prev != NULL) {
-        /* If we've already allocated a node, we just make the
-           already-allocated node the new top */
-        top = top->prev;
-        top->val = val;
-    } else {
-        struct Stack *node = new_stack_node(val);
-        top->prev = node;
-        node->next = top;
-        top = node;
-    }
-    stack_size++;
-}
-
-/* Pops the stack, and returns the popped value */
-int pop_stack() {
-    if (stack_size == 0) {
-        fprintf(stderr, "Error! Can't pop an empty stack!\n");
-        exit(1);
-    } else {
-        int to_return = top->val;
-        top = top->next;
-        stack_size--;
-        return to_return;
-    }
-}
-
-/* Swaps the top two elements of the stack */
-void swap_stack() {
-    int temp;
-
-    if (stack_size < 2) {
-        fprintf(stderr, "Error! Can't swap the top two elements on a%s stack\n",
-                        stack_size == 1 ? " one-element" : "n empty");
-        exit(1);
-    }
-
-    temp = top->val;
-    top->val = top->next->val;
-    top->next->val = temp;
-}
-
-/* Duplicates the top element of the stack */
-void dup_stack() {
-    if (stack_size == 0) {
-        fprintf(stderr, "Error! Nothing on the stack to be duplicated!\n");
-        exit(1);
-    }
-    push_stack(top->val);
-}
-
-/* Sends the top node of the stack to the bottom of the stack */
-void send_top_to_bottom() {
-    if (stack_size == 0) {
-        fprintf(stderr, "Error! Can't send nonexistent value to the bottom of"
-                        " the stack!\n");
-        exit(1);
-    } else if (stack_size == 1) {
-        return;
-    } else {
-        struct Stack *temp = top;
-        top = top->next;
-        top->prev = temp->prev;
-        if (temp->prev != NULL) {
-            temp->prev->next = top;
-        }
-        bottom->next = temp;
-        temp->prev = bottom;
-        bottom = temp;
-        temp->next = NULL;
-    }
-}
-
-/* Randomizes the order of the stack */
-void randomize_stack() {
-    unsigned i, *vals;
-    struct Stack *node;
-
-    if (stack_size == 0) {
-        return;
-    }
-
-    vals = malloc(sizeof(int) * stack_size);
-    if (vals == NULL) {
-        fprintf(stderr, "Error! Unable to allocate additional"
-                        " space\n!");
-    }
-
-    /* Goes through the stack and stores the values in an array */
-    for (i = 0, node = top; node != NULL; node = node->next, i++) {
-        vals[i] = node->val;
-    }
-
-    /* Shuffles the array of values */
-    for (i = stack_size - 1; i > 0; i--) {
-        unsigned swap_index = rand() % (i + 1);
-        int temp = vals[swap_index];
-        vals[swap_index] = vals[i];
-        vals[i] = temp;
-    }
-
-    /* Goes through the list, assigning to each node a shuffled value */
-    for (i = 0, node = top; node != NULL; node = node->next, i++) {
-        node->val = vals[i];
-    }
-
-    free(vals);
-}
-
-/* Frees the stored XRF code */
-void free_xrf_code() {
-    free(code.commands);
-    free(code.visited);
-}
-
-/* Reads a given XRF file */
-void read_xrf_file(const char *filename) {
-    FILE *file = fopen(filename, "r");
-    int cur_cmd, c;
-
-    if (file == NULL) {
-        fprintf(stderr, "Error! Unable to open %s!\n", filename);
-        exit(1);
-    }
-
-    code.commands = NULL;
-    code.visited = NULL;
-    cur_cmd = 0;
-    code.len = 0;
-    atexit(free_xrf_code);
-
-    while ((c = fgetc(file)) != EOF) {
-        if (isspace(c)) {
-            continue;
-        }
-        else if ((c >= '0' && c <= '9') || (c >= 'A' && c <= 'F')) {
-            if (cur_cmd % COMMANDS_PER_CHUNK == 0) {
-                char *new_commands;
-                bool *new_visited;
-
-                code.len += COMMANDS_PER_CHUNK;
-                new_commands = realloc(code.commands, code.len);
-                new_visited = realloc(code.visited, code.len / 5);
-                if (new_commands == NULL || new_visited == NULL) {
-                    fprintf(stderr, "Error! Unable to allocate additional "
-                                    "space for the code!\n");
-                    fclose(file);
-                    free(new_commands);
-                    free(new_visited);
-                    exit(1);
-                }
-                code.commands = new_commands;
-                code.visited = new_visited;
-                code.visited[(code.len / COMMANDS_PER_CHUNK) - 1] = false;
-            }
-            code.commands[cur_cmd++] = c;
-        }
-        else {
-            fprintf(stderr, "Error! Unknown character %c encountered!\n", c);
-            fclose(file);
-            exit(1);
-        }
-    }
-
-    fclose(file);
-
-    if (cur_cmd % COMMANDS_PER_CHUNK != 0) {
-        fprintf(stderr, "Error! Inadequate code length!\n");
-        exit(1);
-    }
-}
-
-/* Executes a chunk of code */
-void execute_chunk(const char *chunk, bool visited) {
-    unsigned i, temp_val;
-
-    for (i = 0; i < COMMANDS_PER_CHUNK; i++) {
-        switch (chunk[i]) {
-            case '0':
-                temp_val = getchar();
-                if (temp_val == (unsigned) EOF)
-                    push_stack(0);
-                else
-                    push_stack(temp_val);
-                break;
-            case '1':
-                if (stack_size == 0) {
-                    fprintf(stderr, "Error! Cannot output nonexistent"
-                                    " value!\n");
-                    exit(1);
-                }
-                putchar(pop_stack());
-                break;
-            case '2':
-                pop_stack();
-                break;
-            case '3':
-                dup_stack();
-                break;
-            case '4':
-                swap_stack();
-                break;
-            case '5':
-                if (stack_size == 0) {
-                    fprintf(stderr, "Error! Cannot increment nonexistent "
-                                    "value!\n");
-                    exit(1);
-                }
-                top->val += 1;
-                break;
-            case '6':
-                if (stack_size == 0) {
-                    fprintf(stderr, "Error! Cannot decrement nonexistent "
-                                    "value!\n");
-                    exit(1);
-                }
-                if (top->val > 0)
-                    top->val -= 1;
-                break;
-            case '7':
-                if (stack_size < 2) {
-                    fprintf(stderr, "Error! Cannot add the top values of a%s\n",
-                            stack_size ? " one-value stack.": "n empty stack.");
-                    exit(1);
-                }
-                top->next->val += top->val;
-                pop_stack();
-                break;
-            case '8':
-                if (!visited) i++;
-                break;
-            case '9':
-                send_top_to_bottom();
-                break;
-            case 'A':
-                return;
-            case 'B':
-                exit(0);
-            case 'C':
-                if (visited) i++;
-                break;
-            case 'D':
-                randomize_stack();
-                break;
-            case 'E':
-                if (stack_size < 2) {
-                    fprintf(stderr, "Error! Cannot get the difference of the"
-                                    " top two values of a%s!\n",
-                            stack_size ? " one-value stack": "n empty stack");
-                    exit(1);
-                }
-                temp_val = pop_stack();
-                if (temp_val <= top->val)
-                    top->val -= temp_val;
-                else
-                    top->val = temp_val - top->val;
-                break;
-        }
-    }
-}
-
-/* Executes the stored XRF code */
-void execute_code() {
-    unsigned cur_chunk = 0;
-
-    top = new_stack_node(0);
-    bottom = top;
-    atexit(free_stack);
-
-    while (true) {
-        execute_chunk(code.commands + (cur_chunk * COMMANDS_PER_CHUNK),
-                      code.visited[cur_chunk]);
-
-        code.visited[cur_chunk] = true;
-        if (stack_size == 0) {
-            fprintf(stderr, "Error! Can't have an empty stack upon reaching "
-                            "the end of a chunk!\n");
-            exit(1);
-        }
-        cur_chunk = top->val;
-        if (cur_chunk >= code.len / COMMANDS_PER_CHUNK) {
-            fprintf(stderr, "Error! Cannot go to nonexistent chunk %u!\n",
-                    top->val);
-            exit(1);
-        }
-    }
-}
-
-int main(int argc, char **argv) {
-    if (argc == 1) {
-        fprintf(stderr, "Error! No filename given!");
-        exit(1);
-    }
-    read_xrf_file(argv[1]);
-    srand(time(NULL));
-    execute_code();
-    return 0;
-}
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "xrf.h"
+
+const size_t INITIAL_CODE_CAPACITY = 256;
+
+const size_t INITIAL_STACK_CAPACITY = 64;
+
+/* Programs are only loaded on several threads when each thread would get at
+   least this much of the text */
+const size_t PARALLEL_LOAD_MIN_RANGE = 1 << 20;
+
+#define MAX_LOAD_THREADS 64
+
+struct Stack stack;
+
+size_t stack_size = 1;
+
+struct Code code;
+
+/* The interpreter cores that can run a program */
+enum Engine {
+    ENGINE_SWITCH, /* Switches on each op, the reference core */
+    ENGINE_GOTO,   /* Direct-threaded with computed gotos */
+    ENGINE_TAIL,   /* Threaded with handlers that tail-call each other */
+    ENGINE_JIT,    /* Compiled to native code */
+    ENGINE_NATIVE, /* Compiled with the C compiler, and cached */
+    ENGINE_STREAM  /* Runs the program as it's read, chosen by --stream */
+};
+
+/* The names of the engines, as given to --engine */
+const char *const ENGINE_NAMES[] = {
+    [ENGINE_SWITCH] = "switch",
+#ifdef __GNUC__
+    [ENGINE_GOTO] = "goto",
+#endif
+    [ENGINE_TAIL] = "tail",
+#ifdef XRF_HAVE_JIT
+    [ENGINE_JIT] = "jit",
+#endif
+#ifdef XRF_HAVE_NATIVE
+    [ENGINE_NATIVE] = "native"
+#endif
+};
+
+/* The tail-call core only runs in constant stack space once the compiler
+   turns its tail calls into jumps, so it's only the default when optimizing */
+#if defined(__OPTIMIZE__)
+#define DEFAULT_ENGINE ENGINE_TAIL
+#elif defined(__GNUC__)
+#define DEFAULT_ENGINE ENGINE_GOTO
+#else
+#define DEFAULT_ENGINE ENGINE_SWITCH
+#endif
+
+/* A slot of threaded code: either the handler of an op, or in the last slot
+   of a variant, the stack use it's guarded with */
+union Thread {
+    const void *label; /* Label of the op in the computed-goto core */
+    void (*handler)(const union Thread *, size_t, unsigned int); /* Handler
+        in the tail-call core, passed the running chunk and the cached top of
+        the stack */
+    unsigned int count; /* How many times the run of ops before it runs, or
+                           how many chunks ahead OP_STEP_CHUNK or
+                           OP_STEP_REVISIT goes */
+    unsigned int (*super)(unsigned int); /* The handler of the generated
+                                            superinstruction before it */
+    const union Thread *link; /* The revisit code that a variant ending in
+                                 OP_REPEAT_CHUNK or OP_REPEAT_REVISIT goes
+                                 on to, or the superblock after OP_BLOCK */
+    size_t chunk; /* The chunk that a variant ending in OP_LINK_CHUNK or
+                     OP_LINK_REVISIT goes on to */
+    struct {
+        unsigned char min_depth; /* As in struct Variant */
+        unsigned char max_growth;
+    } guard;
+};
+
+/* How many slots of threaded code each variant takes up */
+#define THREAD_STRIDE 8
+
+/* The slot of a variant's threaded code holding its guard */
+#define THREAD_GUARD(thread) ((thread)[THREAD_STRIDE - 1].guard)
+
+/* How many chunks the threaded cores run with all of their checks while
+   counting which pairs of ops run most, before building their code */
+#define WARM_UP_CHUNKS 4096
+
+/* The most pairs of ops that get superinstructions */
+#define MAX_SUPERINSTRUCTIONS 8
+
+/* Every pair of the ops in SUPER_INDEX has a fused handler in the threaded
+   cores, but only the pairs that ran most during the warm-up are used.
+   SUPER_PAIRS expands X(first, second) for every pair, in the order they're
+   numbered in, and SUPER_ACTION is what an op does to tos */
+#define SUPER_ROW(X, first)                                               \
+    X(first, input) X(first, output) X(first, pop) X(first, dup)          \
+    X(first, swap) X(first, inc) X(first, dec) X(first, add) X(first, sub)
+
+#define SUPER_PAIRS(X)                                                    \
+    SUPER_ROW(X, input) SUPER_ROW(X, output) SUPER_ROW(X, pop)            \
+    SUPER_ROW(X, dup) SUPER_ROW(X, swap) SUPER_ROW(X, inc)                \
+    SUPER_ROW(X, dec) SUPER_ROW(X, add) SUPER_ROW(X, sub)
+
+#define SUPER_ACTION_input input_cached(tos)
+#define SUPER_ACTION_output output_cached(tos)
+#define SUPER_ACTION_pop pop_cached()
+#define SUPER_ACTION_dup dup_cached(tos)
+#define SUPER_ACTION_swap swap_cached(tos)
+#define SUPER_ACTION_inc tos + 1
+#define SUPER_ACTION_dec dec_cached(tos)
+#define SUPER_ACTION_add add_cached(tos)
+#define SUPER_ACTION_sub sub_cached(tos)
+
+/* The position of each op in the rows of SUPER_PAIRS, plus one */
+const unsigned char SUPER_INDEX[NUM_OPS] = {
+    [OP_INPUT] = 1,
+    [OP_OUTPUT] = 2,
+    [OP_POP] = 3,
+    [OP_DUP] = 4,
+    [OP_SWAP] = 5,
+    [OP_INC] = 6,
+    [OP_DEC] = 7,
+    [OP_ADD] = 8,
+    [OP_SUB] = 9
+};
+
+/* Frees the stack */
+void free_stack() {
+    free(stack.vals);
+    stack.vals = NULL;
+}
+
+/* Initializes the stack to hold a single zero */
+void init_stack() {
+    stack.vals = malloc(sizeof(unsigned int) * INITIAL_STACK_CAPACITY);
+    if (stack.vals == NULL) {
+        fprintf(stderr, "Error! Unable to allocate additional stack space!\n");
+        exit(1);
+    }
+    stack.mask = INITIAL_STACK_CAPACITY - 1;
+    stack.head = 0;
+    stack.vals[0] = 0;
+    stack_size = 1;
+}
+
+/* Doubles the capacity of the stack, unwrapping the values so that the top
+   of the stack ends up at index 0 */
+void grow_stack() {
+    size_t i, capacity = stack.mask + 1;
+    unsigned int *vals = malloc(sizeof(unsigned int) * capacity * 2);
+
+    if (vals == NULL) {
+        fprintf(stderr, "Error! Unable to allocate additional stack space!\n");
+        exit(1);
+    }
+    for (i = 0; i < stack_size; i++) {
+        vals[i] = STACK_AT(i);
+    }
+    free(stack.vals);
+    stack.vals = vals;
+    stack.head = 0;
+    stack.mask = capacity * 2 - 1;
+}
+
+/* Pushes a new value onto the stack */
+void push_stack(unsigned int val) {
+    if (stack_size > stack.mask) {
+        grow_stack();
+    }
+    stack.head = (stack.head - 1) & stack.mask;
+    STACK_TOP = val;
+    stack_size++;
+}
+
+/* Pops the stack, and returns the popped value */
+unsigned int pop_stack() {
+    if (stack_size == 0) {
+        fprintf(stderr, "Error! Can't pop an empty stack!\n");
+        exit(1);
+    } else {
+        unsigned int to_return = STACK_TOP;
+        stack.head = (stack.head + 1) & stack.mask;
+        stack_size--;
+        return to_return;
+    }
+}
+
+/* Swaps the top two elements of the stack */
+void swap_stack() {
+    unsigned int temp;
+
+    if (stack_size < 2) {
+        fprintf(stderr, "Error! Can't swap the top two elements on a%s stack\n",
+                        stack_size == 1 ? " one-element" : "n empty");
+        exit(1);
+    }
+
+    temp = STACK_TOP;
+    STACK_TOP = STACK_AT(1);
+    STACK_AT(1) = temp;
+}
+
+/* Duplicates the top element of the stack */
+void dup_stack() {
+    if (stack_size == 0) {
+        fprintf(stderr, "Error! Nothing on the stack to be duplicated!\n");
+        exit(1);
+    }
+    push_stack(STACK_TOP);
+}
+
+/* Sends the top value of the stack to the bottom of the stack. The slot just
+   past the bottom is reused for it, so this only moves the head index */
+void send_top_to_bottom() {
+    if (stack_size == 0) {
+        fprintf(stderr, "Error! Can't send nonexistent value to the bottom of"
+                        " the stack!\n");
+        exit(1);
+    } else if (stack_size > 1) {
+        unsigned int val = STACK_TOP;
+        stack.head = (stack.head + 1) & stack.mask;
+        STACK_AT(stack_size - 1) = val;
+    }
+}
+
+/* Randomizes the order of the stack, shuffling it in place */
+void randomize_stack() {
+    size_t i;
+
+    for (i = stack_size > 0 ? stack_size - 1 : 0; i > 0; i--) {
+        size_t swap_index = rand() % (i + 1);
+        unsigned int temp = STACK_AT(swap_index);
+        STACK_AT(swap_index) = STACK_AT(i);
+        STACK_AT(i) = temp;
+    }
+}
+
+/* Frees the stored XRF code */
+void free_xrf_code() {
+    if (code.image != NULL) {
+        munmap(code.image, code.image_len);
+        return;
+    }
+    free(code.chunks);
+    free(code.bodies);
+    free(code.variants);
+}
+
+const struct OpEffect OP_EFFECTS[NUM_OPS] = {
+    [OP_INPUT] = { 0, 1 },
+    [OP_OUTPUT] = { 1, -1 },
+    [OP_POP] = { 1, -1 },
+    [OP_DUP] = { 1, 1 },
+    [OP_SWAP] = { 2, 0 },
+    [OP_INC] = { 1, 0 },
+    [OP_DEC] = { 1, 0 },
+    [OP_ADD] = { 2, -1 },
+    [OP_BOTTOM] = { 1, 0 },
+    [OP_EXIT] = { 0, 0 },
+    [OP_RANDOMIZE] = { 0, 0 },
+    [OP_SUB] = { 2, -1 }
+};
+
+/* How many cells below the chunk index find_exit_delta models, which is as
+   far as the ops of a chunk can reach below it */
+#define EXIT_CELLS_BELOW (COMMANDS_PER_CHUNK + 1)
+
+/* Works out where a variant goes next, relative to the chunk it runs in.
+   On entry the top of the stack is always the index of the running chunk,
+   since that's how the chunk was picked. Following that value through the
+   ops can show that it's on top again at the end, offset by the increments
+   and decrements it went through.
+
+   Each modelled cell holds its offset from the index, or EXIT_DYNAMIC if it
+   holds some other value. The cells below the index start out as unknown
+   values of their own, so the index can be swapped down into them and back
+   up again. Decrements are only followed while the value is sure to be
+   above zero, so the offset never goes below zero */
+int find_exit_delta(const struct Variant *variant) {
+    int cells[EXIT_CELLS_BELOW + 1 + COMMANDS_PER_CHUNK];
+    int top = EXIT_CELLS_BELOW, temp;
+    unsigned i;
+
+    for (i = 0; i < EXIT_CELLS_BELOW; i++) {
+        cells[i] = EXIT_DYNAMIC;
+    }
+    cells[top] = 0;
+    for (i = 0; i < variant->len; i++) {
+        switch (variant->ops[i]) {
+            case OP_INPUT:
+                cells[++top] = EXIT_DYNAMIC;
+                break;
+            case OP_DUP:
+                temp = cells[top];
+                cells[++top] = temp;
+                break;
+            case OP_OUTPUT:
+            case OP_POP:
+                top--;
+                break;
+            case OP_SWAP:
+                temp = cells[top];
+                cells[top] = cells[top - 1];
+                cells[top - 1] = temp;
+                break;
+            case OP_INC:
+                if (cells[top] != EXIT_DYNAMIC) {
+                    cells[top]++;
+                }
+                break;
+            case OP_DEC:
+                if (cells[top] != EXIT_DYNAMIC) {
+                    cells[top] = cells[top] > 0 ? cells[top] - 1
+                                                : EXIT_DYNAMIC;
+                }
+                break;
+            case OP_ADD:
+            case OP_SUB:
+                cells[--top] = EXIT_DYNAMIC;
+                break;
+            case OP_BOTTOM:
+            case OP_RANDOMIZE:
+                /* Where the values end up depends on how deep the stack
+                   is */
+                return EXIT_DYNAMIC;
+            case OP_EXIT:
+                return EXIT_DYNAMIC;
+        }
+    }
+    return cells[top];
+}
+
+/* Works out the stack effect of a variant's ops */
+void analyze_variant(struct Variant *variant) {
+    int depth = 0, min_depth = 0, max_growth = 0;
+    unsigned i;
+
+    for (i = 0; i < variant->len; i++) {
+        unsigned char op = variant->ops[i];
+
+        if (OP_EFFECTS[op].needs - depth > min_depth) {
+            min_depth = OP_EFFECTS[op].needs - depth;
+        }
+        depth += OP_EFFECTS[op].delta;
+        if (depth > max_growth) {
+            max_growth = depth;
+        }
+    }
+
+    /* Unless the program exits, the stack can't be empty at the end */
+    if ((i == 0 || variant->ops[i - 1] != OP_EXIT) && 1 - depth > min_depth) {
+        min_depth = 1 - depth;
+    }
+
+    variant->min_depth = min_depth;
+    variant->net_delta = depth;
+    variant->max_growth = max_growth;
+    variant->exit_delta = find_exit_delta(variant);
+}
+
+/* Resolves the ops a chunk runs on a first visit or a revisit */
+void compile_variant(struct Variant *variant, uint32_t body, bool visited) {
+    unsigned i;
+
+    variant->len = 0;
+    for (i = 0; i < COMMANDS_PER_CHUNK; i++) {
+        switch (CHUNK_OP(body, i)) {
+            case OP_SKIP_UNVISITED:
+                if (!visited) i++;
+                break;
+            case OP_SKIP_VISITED:
+                if (visited) i++;
+                break;
+            case OP_NOP:
+                break;
+            case OP_END_CHUNK:
+                i = COMMANDS_PER_CHUNK;
+                break;
+            case OP_EXIT:
+                variant->ops[variant->len++] = OP_EXIT;
+                i = COMMANDS_PER_CHUNK;
+                break;
+            default:
+                variant->ops[variant->len++] = CHUNK_OP(body, i);
+                break;
+        }
+    }
+    analyze_variant(variant);
+}
+
+/* Packs the commands of a chunk into its body */
+uint32_t pack_chunk(const unsigned char *cmds) {
+    uint32_t body = 0;
+    unsigned i;
+
+    for (i = 0; i < COMMANDS_PER_CHUNK; i++) {
+        body |= (uint32_t) decode_command(cmds[i]) << (4 * i);
+    }
+    return body;
+}
+
+/* Reads the whole of a file that can't be mapped into a malloc'd buffer */
+unsigned char *read_whole_file(int fd, size_t *len) {
+    size_t capacity = INITIAL_CODE_CAPACITY;
+    unsigned char *buf = malloc(capacity);
+
+    *len = 0;
+    while (buf != NULL) {
+        ssize_t n;
+
+        if (*len == capacity) {
+            unsigned char *new_buf = realloc(buf, capacity * 2);
+
+            if (new_buf == NULL) {
+                break;
+            }
+            buf = new_buf;
+            capacity *= 2;
+        }
+        n = read(fd, buf + *len, capacity - *len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n <= 0) {
+            return buf;
+        }
+        *len += n;
+    }
+    free(buf);
+    fprintf(stderr, "Error! Unable to allocate additional "
+                    "space for the code!\n");
+    exit(1);
+}
+
+/* Checks that a program's commands make whole chunks, and allocates them
+   along with their padding */
+void alloc_chunks(size_t count) {
+    if (count % COMMANDS_PER_CHUNK != 0) {
+        fprintf(stderr, "Error! Inadequate code length!\n");
+        exit(1);
+    }
+
+    code.num_chunks = count / COMMANDS_PER_CHUNK;
+    code.chunks = calloc(code.num_chunks + CHUNK_PADDING, sizeof(uint32_t));
+    if (code.chunks == NULL) {
+        fprintf(stderr, "Error! Unable to allocate additional "
+                        "space for the code!\n");
+        exit(1);
+    }
+    atexit(free_xrf_code);
+}
+
+/* One thread's share of loading a program. A range of the text is scanned
+   and compacted in place, and then its commands are packed into the chunks
+   starting at offset */
+struct LoadRange {
+    const unsigned char *text;
+    unsigned char *cmds;
+    size_t start, end;
+    size_t count, bad;
+    size_t offset;
+};
+
+/* Scans a range of the text, leaving its commands at the same offset of the
+   command buffer */
+void *scan_range(void *arg) {
+    struct LoadRange *range = arg;
+
+    range->count = scan_commands(range->text + range->start,
+                                 range->end - range->start,
+                                 range->cmds + range->start, &range->bad);
+    range->bad += range->start;
+    return NULL;
+}
+
+/* Stores the body of a chunk packed by a range. Chunks that straddle two
+   ranges are put together by both of their threads, so their commands are
+   added with an atomic OR instead */
+static inline void store_body(size_t index, uint32_t body, bool whole) {
+    if (whole) {
+        code.chunks[index] = body;
+    } else {
+        __atomic_fetch_or(&code.chunks[index], body, __ATOMIC_RELAXED);
+    }
+}
+
+/* Packs the bodies of a range's commands into their chunks, to be interned
+   once they're all there */
+void *pack_range(void *arg) {
+    struct LoadRange *range = arg;
+    const unsigned char *cmds = range->cmds + range->start;
+    size_t i, index = range->offset / COMMANDS_PER_CHUNK;
+    unsigned slot = range->offset % COMMANDS_PER_CHUNK;
+    bool whole = slot == 0;
+    uint32_t body = 0;
+
+    for (i = 0; i < range->count; i++) {
+        body |= (uint32_t) decode_command(cmds[i]) << (4 * slot);
+        if (++slot == COMMANDS_PER_CHUNK) {
+            store_body(index++, body, whole);
+            body = 0;
+            slot = 0;
+            whole = true;
+        }
+    }
+    if (slot != 0) {
+        store_body(index, body, false);
+    }
+    return NULL;
+}
+
+/* Replaces the body held by every chunk with the index of its entry in the
+   table of unique bodies, numbered in the order they first appear, fills in
+   the padding past the last chunk, and then compiles both variants of each
+   unique body */
+void intern_chunks() {
+    size_t i, capacity = code.num_chunks < CHUNK_VISITED
+                       ? code.num_chunks : CHUNK_VISITED;
+    uint32_t *index_of = calloc(CHUNK_VISITED, sizeof(uint32_t));
+
+    code.bodies = malloc(sizeof(uint32_t) * (capacity > 0 ? capacity : 1));
+    if (index_of == NULL || code.bodies == NULL) {
+        fprintf(stderr, "Error! Unable to allocate additional "
+                        "space for the code!\n");
+        exit(1);
+    }
+
+    /* Indices are stored plus one, so that zero means not seen yet */
+    code.num_bodies = 0;
+    for (i = 0; i < code.num_chunks; i++) {
+        uint32_t body = code.chunks[i];
+
+        if (index_of[body] == 0) {
+            code.bodies[code.num_bodies++] = body;
+            index_of[body] = code.num_bodies;
+        }
+        code.chunks[i] = index_of[body] - 1;
+    }
+    free(index_of);
+    code.padded = code.num_bodies < CHUNK_VISITED;
+    for (i = 0; code.padded && i < CHUNK_PADDING; i++) {
+        code.chunks[code.num_chunks + i] = code.num_bodies;
+    }
+
+    code.variants = malloc(sizeof(struct Variant)
+                           * (code.num_bodies > 0 ? 2 * code.num_bodies : 1));
+    if (code.variants == NULL) {
+        fprintf(stderr, "Error! Unable to allocate additional "
+                        "space for the code!\n");
+        exit(1);
+    }
+    for (i = 0; i < code.num_bodies; i++) {
+        compile_variant(&code.variants[i * 2], code.bodies[i], false);
+        compile_variant(&code.variants[i * 2 + 1], code.bodies[i], true);
+    }
+}
+
+size_t *find_sole_chunks() {
+    size_t i, *sole = malloc(sizeof(size_t)
+                             * (code.num_bodies > 0 ? code.num_bodies : 1));
+
+    if (sole == NULL) {
+        fprintf(stderr, "Error! Unable to allocate additional "
+                        "space for the code!\n");
+        exit(1);
+    }
+    /* Every body has at least one chunk, so num_chunks marks the bodies no
+       chunk has been found for yet */
+    for (i = 0; i < code.num_bodies; i++) {
+        sole[i] = code.num_chunks;
+    }
+    for (i = 0; i < code.num_chunks; i++) {
+        size_t unique = CHUNK_UNIQUE(code.chunks[i]);
+
+        sole[unique] = sole[unique] == code.num_chunks ? i : SHARED_BODY;
+    }
+    return sole;
+}
+
+/* Runs a worker over every range, on a thread of its own where it can */
+void run_load_workers(void *(*worker)(void *), struct LoadRange *ranges,
+                      size_t num_ranges)
+{
+    pthread_t workers[MAX_LOAD_THREADS];
+    bool started[MAX_LOAD_THREADS];
+    size_t i;
+
+    for (i = 1; i < num_ranges; i++) {
+        started[i] = pthread_create(&workers[i], NULL, worker,
+                                    &ranges[i]) == 0;
+    }
+    worker(&ranges[0]);
+    for (i = 1; i < num_ranges; i++) {
+        if (started[i]) {
+            pthread_join(workers[i], NULL);
+        } else {
+            worker(&ranges[i]);
+        }
+    }
+}
+
+/* Works out how many threads to load len bytes of text with */
+size_t load_thread_count(size_t len) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t n = len / PARALLEL_LOAD_MIN_RANGE;
+
+    if (cpus > 0 && n > (size_t) cpus) {
+        n = cpus;
+    }
+    if (n == 0) {
+        return 1;
+    }
+    return n < MAX_LOAD_THREADS ? n : MAX_LOAD_THREADS;
+}
+
+/* Loads a program's text, on several threads if there's more than one range.
+   The text is split into ranges that are scanned at once, the first bad
+   character of the earliest range that has one is reported just as a serial
+   scan would, and then each range's commands are packed at the offset given
+   by the counts of the ranges before it. The chunks are then interned */
+void load_program(const unsigned char *text, size_t len,
+                   unsigned char *cmds, size_t num_ranges)
+{
+    struct LoadRange ranges[MAX_LOAD_THREADS];
+    size_t i, total = 0;
+
+    memset(ranges, 0, sizeof(ranges));
+    for (i = 0; i < num_ranges; i++) {
+        ranges[i].text = text;
+        ranges[i].cmds = cmds;
+        ranges[i].start = len / num_ranges * i;
+        ranges[i].end = i + 1 < num_ranges ? len / num_ranges * (i + 1) : len;
+    }
+    run_load_workers(scan_range, ranges, num_ranges);
+
+    for (i = 0; i < num_ranges; i++) {
+        if (ranges[i].bad < ranges[i].end) {
+            report_bad_character(text[ranges[i].bad]);
+        }
+        ranges[i].offset = total;
+        total += ranges[i].count;
+    }
+    alloc_chunks(total);
+    run_load_workers(pack_range, ranges, num_ranges);
+    intern_chunks();
+}
+
+/* Reads a given XRF file, decoding it into chunks, unless it's a compiled
+   program. The file is mapped if it can be, and its commands are compacted
+   into a buffer that's allocated once at its largest possible size before
+   being decoded. Large files are loaded on several threads */
+void read_xrf_file(const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    struct stat info;
+    unsigned char *text, *cmds;
+    size_t len;
+    bool mapped = false;
+
+    if (fd < 0) {
+        fprintf(stderr, "Error! Unable to open %s!\n", filename);
+        exit(1);
+    }
+    if (load_image(fd, filename)) {
+        close(fd);
+        return;
+    }
+
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        len = info.st_size;
+        text = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        mapped = text != MAP_FAILED;
+    }
+    if (mapped) {
+        madvise(text, len, MADV_SEQUENTIAL);
+    } else {
+        text = read_whole_file(fd, &len);
+    }
+    close(fd);
+
+    cmds = malloc(len > 0 ? len : 1);
+    if (cmds == NULL) {
+        fprintf(stderr, "Error! Unable to allocate additional "
+                        "space for the code!\n");
+        exit(1);
+    }
+    init_scanner();
+    load_program(text, len, cmds, load_thread_count(len));
+
+    if (mapped) {
+        munmap(text, len);
+    } else {
+        free(text);
+    }
+    free(cmds);
+}
+
+/* Runs a single op that isn't a skip or the end of a chunk, with all of its
+   checks */
+static inline void execute_op(unsigned op) {
+    switch (op) {
+        case OP_INPUT:
+            op_input();
+            break;
+        case OP_OUTPUT:
+            op_output();
+            break;
+        case OP_POP:
+            pop_stack();
+            break;
+        case OP_DUP:
+            dup_stack();
+            break;
+        case OP_SWAP:
+            swap_stack();
+            break;
+        case OP_INC:
+            op_inc();
+            break;
+        case OP_DEC:
+            op_dec();
+            break;
+        case OP_ADD:
+            op_add();
+            break;
+        case OP_BOTTOM:
+            send_top_to_bottom();
+            break;
+        case OP_EXIT:
+            exit(0);
+        case OP_RANDOMIZE:
+            randomize_stack();
+            break;
+        case OP_SUB:
+            op_sub();
+            break;
+    }
+}
+
+/* Executes the ops of a chunk body with all of their checks, as they run on
+   a first visit or a revisit. The ops are decoded from the packed body as
+   they go */
+void execute_chunk(uint32_t body, bool visited) {
+    unsigned i;
+
+    for (i = 0; i < COMMANDS_PER_CHUNK; i++) {
+        switch (CHUNK_OP(body, i)) {
+            case OP_SKIP_UNVISITED:
+                if (!visited) i++;
+                break;
+            case OP_SKIP_VISITED:
+                if (visited) i++;
+                break;
+            case OP_END_CHUNK:
+                return;
+            default:
+                execute_op(CHUNK_OP(body, i));
+        }
+    }
+}
+
+/* Executes the ops of a compiled variant with all of their checks. Its skips
+   are already resolved, so nothing depends on whether the chunk is visited */
+void execute_variant(const struct Variant *variant) {
+    unsigned i;
+
+    for (i = 0; i < variant->len; i++) {
+        execute_op(variant->ops[i]);
+    }
+}
+
+/* Runs the program with the reference core, switching on every op. It counts
+   down the chunks that haven't been visited yet, and once there are none left
+   the visited bits can't change anymore, so it runs only the revisit variants
+   from then on, without marking or checking anything */
+void run_switch_engine() {
+    uint32_t *chunk = code.chunks;
+    size_t unvisited = code.num_chunks;
+
+    while (unvisited > 0) {
+        if (CHUNK_IS_VISITED(*chunk)) {
+            execute_chunk(CHUNK_BODY(*chunk), true);
+            chunk = follow_chunk();
+        } else {
+            execute_chunk(CHUNK_BODY(*chunk), false);
+            unvisited--;
+            chunk = next_chunk(chunk);
+        }
+    }
+    while (true) {
+        execute_variant(&code.variants[CHUNK_UNIQUE(*chunk) * 2 + 1]);
+        chunk = follow_chunk();
+    }
+}
+
+/* Makes room on the stack for n more values */
+void reserve_stack(size_t n) {
+    while (stack_size + n > stack.mask + 1) {
+        grow_stack();
+    }
+}
+
+/* The threaded code of both variants of every unique chunk body, used by the
+   threaded cores */
+static union Thread *threads;
+
+/* The threaded code of the superblocks, each of which runs the revisit
+   variants of a chain of chunks one after the other */
+static union Thread *superblocks;
+
+#ifdef XRF_SUCCESSOR_CACHE
+/* The chunk that each chunk last went on to through the top of the stack,
+   which starts out as chunk 0 */
+static uint32_t *successors;
+#endif
+
+/* Frees the threaded code */
+void free_threads() {
+    free(threads);
+    free(superblocks);
+#ifdef XRF_SUCCESSOR_CACHE
+    free(successors);
+#endif
+}
+
+/* Returns the number of the superinstruction for the ops at i and i + 1 of a
+   variant as lowered, or -1 if they can't be fused */
+int fused_pair(const struct FusedOp *fused, unsigned len, unsigned i) {
+    if (i + 1 >= len || fused[i].count > 1 || fused[i + 1].count > 1
+        || SUPER_INDEX[fused[i].op] == 0 || SUPER_INDEX[fused[i + 1].op] == 0)
+    {
+        return -1;
+    }
+    return (SUPER_INDEX[fused[i].op] - 1) * NUM_SUPER_OPS
+           + SUPER_INDEX[fused[i + 1].op] - 1;
+}
+
+/* Returns the longest generated superinstruction for the ops starting at i
+   of a variant as lowered, or NULL if none of them match */
+const struct Superinstruction *match_superinstruction(
+    const struct FusedOp *fused, unsigned len, unsigned i)
+{
+    const struct Superinstruction *best = NULL;
+    size_t s;
+    unsigned j;
+
+    for (s = 0; s < NUM_SUPERINSTRUCTIONS; s++) {
+        const struct Superinstruction *super = &SUPERINSTRUCTIONS[s];
+
+        if (i + super->len > len || (best != NULL && super->len <= best->len))
+        {
+            continue;
+        }
+        for (j = 0; j < super->len; j++) {
+            if (fused[i + j].op != super->ops[j] || fused[i + j].count > 1) {
+                break;
+            }
+        }
+        if (j == super->len) {
+            best = super;
+        }
+    }
+    return best;
+}
+
+/* Translates the ops of a variant as lowered into threaded code through
+   table, returning how many slots they take up. A run of ops takes up a slot
+   for the op and one for how many times it runs, which is never more slots
+   than the run was to begin with. The longest generated superinstruction
+   that matches the ops takes a slot for OP_SUPER and one for its handler.
+   Otherwise a pair of ops that's been chosen for a superinstruction takes a
+   single slot, holding its entry in pairs */
+unsigned thread_ops(union Thread *thread, const struct FusedOp *fused,
+                    unsigned len, const union Thread *table,
+                    const union Thread *pairs, const bool *chosen)
+{
+    static const unsigned char RUN_OPS[NUM_OPS] = {
+        [OP_INC] = OP_INC_N,
+        [OP_DEC] = OP_DEC_N,
+        [OP_POP] = OP_POP_N
+    };
+    unsigned j, k;
+
+    for (j = k = 0; k < len; k++) {
+        const struct Superinstruction *super =
+            match_superinstruction(fused, len, k);
+        int pair = fused_pair(fused, len, k);
+
+        if (super != NULL) {
+            thread[j++] = table[OP_SUPER];
+            thread[j++].super = super->run;
+            k += super->len - 1;
+        } else if (pair >= 0 && chosen[pair]) {
+            thread[j++] = pairs[pair];
+            k++;
+        } else if (fused[k].count > 1) {
+            thread[j++] = table[RUN_OPS[fused[k].op]];
+            thread[j++].count = fused[k].count;
+        } else {
+            thread[j++] = table[fused[k].op];
+        }
+    }
+    return j;
+}
+
+/* The most chunks a superblock is fused from */
+#define MAX_SUPERBLOCK_CHUNKS 8
+
+/* The most slots the threaded code of a superblock fused from n chunks can
+   take up, which is the ops of every chunk and the exit of the last one */
+#define SUPERBLOCK_SLOTS(n) ((n) * COMMANDS_PER_CHUNK + 2)
+
+/* What build_superblocks has found out about the chunk of a body that only
+   one chunk has */
+#define BLOCK_FOLLOWS 1 /* It can be fused onto the chunk before it */
+#define BLOCK_FUSED 2   /* It's in a superblock already */
+
+/* Returns the chunk that the revisit variant of a chunk whose body is its
+   own can have fused onto it in a superblock, or SHARED_BODY if there isn't
+   one. That's the chunk the variant always goes on to, as long as that
+   chunk's body is its own too, it was visited during the warm-up so it's
+   always revisited from now on, and no other chunk always goes on to it.
+   preds holds how many chunks always go on to the chunk of each body, up to
+   two */
+size_t block_successor(size_t chunk, const size_t *sole,
+                       const unsigned char *preds)
+{
+    const struct Variant *variant =
+        &code.variants[CHUNK_UNIQUE(code.chunks[chunk]) * 2 + 1];
+    size_t next = chunk + variant->exit_delta, unique;
+
+    if (variant->exit_delta <= 0 || next >= code.num_chunks) {
+        return SHARED_BODY;
+    }
+    unique = CHUNK_UNIQUE(code.chunks[next]);
+    if (sole[unique] != next || !CHUNK_IS_VISITED(code.chunks[next])
+        || preds[unique] != 1)
+    {
+        return SHARED_BODY;
+    }
+    return next;
+}
+
+/* Counts how many chunks always go on to the chunk of each body that only
+   one chunk has, up to two, into preds */
+void count_preds(const size_t *sole, unsigned char *preds) {
+    size_t i, next;
+    unsigned v;
+
+    for (i = 0; i < code.num_chunks; i++) {
+        for (v = 0; v < 2; v++) {
+            const struct Variant *variant =
+                &code.variants[CHUNK_UNIQUE(code.chunks[i]) * 2 + v];
+            size_t unique;
+
+            /* Both variants going to the same chunk count once */
+            next = i + variant->exit_delta;
+            if (variant->exit_delta <= 0 || next >= code.num_chunks
+                || (v == 1 && variant->exit_delta == variant[-1].exit_delta))
+            {
+                continue;
+            }
+            unique = CHUNK_UNIQUE(code.chunks[next]);
+            if (sole[unique] == next && preds[unique] < 2) {
+                preds[unique]++;
+            }
+        }
+    }
+}
+
+/* Fuses the revisit code of chains of chunks into superblocks, so that the
+   chunks of a chain run one after the other without going through a
+   transition. A chain starts at a chunk whose body is its own, and goes on
+   through the chunks that block_successor finds. Chains are started from the
+   chunks that can't be fused onto the one before them first, and then from
+   the ones left over, which are in loops.
+
+   The revisit code of the first chunk of a chain becomes OP_BLOCK, followed
+   by the link to the superblock, and is guarded with the stack use of the
+   whole chain. Every chunk of the chain always runs once the first one does,
+   so the guard only fails when one of them would fail its own, and then
+   prepare_chunk runs them with all of their checks until it does. The
+   superblock holds the ops of every chunk, followed by OP_LINK_REVISIT and
+   the chunk that the last one always goes on to, or OP_NEXT_REVISIT */
+void build_superblocks(const union Thread *table, const union Thread *pairs,
+                       const bool *chosen, const size_t *sole)
+{
+    struct FusedOp fused[MAX_SUPERBLOCK_CHUNKS * COMMANDS_PER_CHUNK];
+    unsigned char *flags = calloc(code.num_bodies, 1);
+    unsigned char *preds = calloc(code.num_bodies, 1);
+    unsigned char *lengths = malloc(code.num_bodies);
+    size_t *members = malloc(sizeof(size_t) * code.num_bodies);
+    size_t i, next, num_chains = 0, num_members = 0, slots = 0;
+    unsigned pass, n, j, len;
+
+    if (flags == NULL || preds == NULL || lengths == NULL || members == NULL)
+    {
+        fprintf(stderr, "Error! Unable to allocate additional "
+                        "space for the code!\n");
+        exit(1);
+    }
+    count_preds(sole, preds);
+    for (i = 0; i < code.num_bodies; i++) {
+        if (sole[i] != SHARED_BODY && CHUNK_IS_VISITED(code.chunks[sole[i]])
+            && (next = block_successor(sole[i], sole, preds)) != SHARED_BODY)
+        {
+            flags[CHUNK_UNIQUE(code.chunks[next])] |= BLOCK_FOLLOWS;
+        }
+    }
+
+    for (pass = 0; pass < 2; pass++) {
+        for (i = 0; i < code.num_bodies; i++) {
+            if (sole[i] == SHARED_BODY
+                || !CHUNK_IS_VISITED(code.chunks[sole[i]])
+                || (flags[i] & BLOCK_FUSED) != 0
+                || (pass == 0 && (flags[i] & BLOCK_FOLLOWS) != 0))
+            {
+                continue;
+            }
+            members[num_members] = sole[i];
+            for (n = 1; n < MAX_SUPERBLOCK_CHUNKS; n++) {
+                next = block_successor(members[num_members + n - 1], sole,
+                                       preds);
+                if (next == SHARED_BODY || next == sole[i]
+                    || (flags[CHUNK_UNIQUE(code.chunks[next])]
+                        & BLOCK_FUSED) != 0)
+                {
+                    break;
+                }
+                members[num_members + n] = next;
+                flags[CHUNK_UNIQUE(code.chunks[next])] |= BLOCK_FUSED;
+            }
+            if (n > 1) {
+                flags[i] |= BLOCK_FUSED;
+                lengths[num_chains++] = n;
+                num_members += n;
+                slots += SUPERBLOCK_SLOTS(n);
+            }
+        }
+    }
+    free(flags);
+    free(preds);
+
+    superblocks = malloc(sizeof(union Thread) * (slots > 0 ? slots : 1));
+    if (superblocks == NULL) {
+        fprintf(stderr, "Error! Unable to allocate additional "
+                        "space for the code!\n");
+        exit(1);
+    }
+    slots = 0;
+    num_members = 0;
+    for (i = 0; i < num_chains; i++) {
+        const size_t *chain = &members[num_members];
+        union Thread *block = &superblocks[slots];
+        union Thread *thread = &threads[(CHUNK_UNIQUE(code.chunks[chain[0]])
+                                         * 2 + 1) * THREAD_STRIDE];
+        const struct Variant *variant = NULL;
+        int depth = 0, min_depth = 0, max_growth = 0;
+
+        for (n = len = 0; n < lengths[i]; n++) {
+            variant = &code.variants[CHUNK_UNIQUE(code.chunks[chain[n]]) * 2
+                                     + 1];
+            if (variant->min_depth - depth > min_depth) {
+                min_depth = variant->min_depth - depth;
+            }
+            if (depth + variant->max_growth > max_growth) {
+                max_growth = depth + variant->max_growth;
+            }
+            depth += variant->net_delta;
+            len += lower_variant(variant, fused + len);
+        }
+        j = thread_ops(block, fused, len, table, pairs, chosen);
+        next = chain[n - 1] + variant->exit_delta;
+        if (variant->exit_delta != EXIT_DYNAMIC && next < code.num_chunks) {
+            block[j] = table[OP_LINK_REVISIT];
+            block[j + 1].chunk = next;
+        } else {
+            block[j] = table[OP_NEXT_REVISIT];
+        }
+
+        thread[0] = table[OP_BLOCK];
+        thread[1].link = block;
+        THREAD_GUARD(thread).min_depth = min_depth;
+        THREAD_GUARD(thread).max_growth = max_growth;
+        num_members += lengths[i];
+        slots += SUPERBLOCK_SLOTS(lengths[i]);
+    }
+    free(lengths);
+    free(members);
+}
+
+/* Builds the threaded code of both variants of every unique body. Each
+   variant gets THREAD_STRIDE slots, starting with its ops as translated by
+   thread_ops.
+
+   Then comes the table entry for OP_NEXT_CHUNK, or OP_NEXT_REVISIT for a
+   revisit variant since its chunk is already marked visited. A variant that
+   always goes back to its own chunk is linked straight to the revisit code
+   of its body instead, with OP_REPEAT_CHUNK or OP_REPEAT_REVISIT followed by
+   the link. One that always goes on to some other chunk, which is only known
+   when its body has a single chunk, ends with OP_LINK_CHUNK or
+   OP_LINK_REVISIT followed by that chunk, so the next chunk is neither read
+   off the stack nor checked. Otherwise, when the chunks are padded, one that
+   always goes the same number of chunks ahead ends with OP_STEP_CHUNK or
+   OP_STEP_REVISIT followed by that number, and going past the last chunk
+   lands on the padding, whose code is OP_NO_CHUNK. The last slot holds the
+   stack use the variant is guarded with. Chunks that share a body share its
+   code, so the index of the running chunk is kept by the core instead.
+   Chains of chunks are then fused into superblocks */
+void build_threads(const union Thread *table, const union Thread *pairs,
+                   const bool *chosen)
+{
+    struct FusedOp fused[COMMANDS_PER_CHUNK];
+    size_t i, next, *sole = find_sole_chunks();
+    unsigned v, j;
+
+    /* With room for the code of the padding, which is unguarded */
+    threads = calloc(THREAD_STRIDE * 2 * (code.num_bodies + 1),
+                     sizeof(union Thread));
+    atexit(free_threads);
+    if (threads == NULL) {
+        fprintf(stderr, "Error! Unable to allocate additional "
+                        "space for the code!\n");
+        exit(1);
+    }
+#ifdef XRF_SUCCESSOR_CACHE
+    successors = calloc(code.num_chunks, sizeof(uint32_t));
+    if (successors == NULL) {
+        fprintf(stderr, "Error! Unable to allocate additional "
+                        "space for the code!\n");
+        exit(1);
+    }
+#endif
+    for (i = 0; i < code.num_bodies; i++) {
+        for (v = 0; v < 2; v++) {
+            union Thread *thread = &threads[(i * 2 + v) * THREAD_STRIDE];
+            const struct Variant *variant = &code.variants[i * 2 + v];
+
+            j = thread_ops(thread, fused, lower_variant(variant, fused),
+                           table, pairs, chosen);
+            if (variant->exit_delta == 0) {
+                thread[j] = table[v ? OP_REPEAT_REVISIT : OP_REPEAT_CHUNK];
+                thread[j + 1].link = &threads[(i * 2 + 1) * THREAD_STRIDE];
+            } else if (variant->exit_delta != EXIT_DYNAMIC
+                       && sole[i] != SHARED_BODY
+                       && (next = sole[i] + variant->exit_delta)
+                          < code.num_chunks)
+            {
+                thread[j] = table[v ? OP_LINK_REVISIT : OP_LINK_CHUNK];
+                thread[j + 1].chunk = next;
+            } else if (variant->exit_delta != EXIT_DYNAMIC && code.padded) {
+                thread[j] = table[v ? OP_STEP_REVISIT : OP_STEP_CHUNK];
+                thread[j + 1].count = variant->exit_delta;
+            } else {
+                thread[j] = table[v ? OP_NEXT_REVISIT : OP_NEXT_CHUNK];
+            }
+            THREAD_GUARD(thread).min_depth = variant->min_depth;
+            THREAD_GUARD(thread).max_growth = variant->max_growth;
+        }
+    }
+    threads[code.num_bodies * 2 * THREAD_STRIDE] = table[OP_NO_CHUNK];
+    threads[(code.num_bodies * 2 + 1) * THREAD_STRIDE] = table[OP_NO_CHUNK];
+    build_superblocks(table, pairs, chosen, sole);
+    free(sole);
+}
+
+/* Runs the start of the program with all of its checks, counting how often
+   each pair of ops that could be fused runs, then builds the threaded code
+   with superinstructions for the pairs that ran most. The pairs the warm-up
+   didn't see keep their ops apart. Returns the chunk to go on from, which
+   the top of the stack points to */
+size_t warm_up_threads(const union Thread *table, const union Thread *pairs) {
+    static unsigned long counts[NUM_SUPER_OPS * NUM_SUPER_OPS];
+    bool chosen[NUM_SUPER_OPS * NUM_SUPER_OPS] = { false };
+    struct FusedOp fused[COMMANDS_PER_CHUNK];
+    uint32_t *chunk = code.chunks;
+    unsigned i, k, len, best;
+    size_t n;
+
+    for (n = 0; n < WARM_UP_CHUNKS; n++) {
+        const struct Variant *variant =
+            &code.variants[CHUNK_UNIQUE(*chunk) * 2
+                           + CHUNK_IS_VISITED(*chunk)];
+
+        len = lower_variant(variant, fused);
+        for (k = 0; k < len; k++) {
+            int pair = fused_pair(fused, len, k);
+
+            if (pair >= 0) {
+                counts[pair]++;
+            }
+        }
+        execute_variant(variant);
+        chunk = next_chunk(chunk);
+    }
+
+    for (i = 0; i < MAX_SUPERINSTRUCTIONS; i++) {
+        best = 0;
+        for (k = 1; k < NUM_SUPER_OPS * NUM_SUPER_OPS; k++) {
+            best = counts[k] > counts[best] ? k : best;
+        }
+        if (counts[best] == 0) {
+            break;
+        }
+        chosen[best] = true;
+        counts[best] = 0;
+    }
+
+    build_threads(table, pairs, chosen);
+    return chunk - code.chunks;
+}
+
+/* Returns the threaded code of the variant of a chunk that runs next */
+#define THREAD_OF(chunk)                                        \
+    (&threads[(CHUNK_UNIQUE(code.chunks[chunk]) * 2            \
+               + CHUNK_IS_VISITED(code.chunks[chunk])) * THREAD_STRIDE])
+
+/* The slow path of guard_chunk */
+size_t prepare_chunk(size_t chunk) {
+    /* A superblock's guard covers the chunks after the first, so they're
+       run with their checks until the one that underflows reports it */
+    while (stack_size < THREAD_GUARD(THREAD_OF(chunk)).min_depth) {
+        uint32_t packed = code.chunks[chunk];
+
+        execute_chunk(CHUNK_BODY(packed), CHUNK_IS_VISITED(packed));
+        chunk = next_chunk(&code.chunks[chunk]) - code.chunks;
+    }
+    reserve_stack(THREAD_GUARD(THREAD_OF(chunk)).max_growth);
+    return chunk;
+}
+
+/* Returns chunk once its next variant can run without any checks, which is
+   when the stack is at least as deep as the variant needs, and has room for
+   all it pushes. If the stack is too shallow, the variant is run with all of
+   its checks to report the error. The threaded cores keep the top of the
+   stack in *tos, so it's spilled around the slow path, which works on the
+   stack itself */
+static inline size_t guard_chunk(size_t chunk, unsigned int *tos) {
+    const union Thread *thread = THREAD_OF(chunk);
+
+    if (stack_size < THREAD_GUARD(thread).min_depth
+        || stack_size + THREAD_GUARD(thread).max_growth > stack.mask + 1)
+    {
+        spill_top(*tos);
+        chunk = prepare_chunk(chunk);
+        *tos = STACK_TOP;
+    }
+    return chunk;
+}
+
+/* Returns the guarded chunk that the cached top of the stack points to once
+   a variant of chunk has run unchecked. The guard on entry already made sure
+   the stack isn't empty.
+
+   Built with XRF_SUCCESSOR_CACHE, the chunk each chunk last went on to is
+   remembered. Only chunks that exist are, so going on to the same one again
+   needs no check, and the code of the chunk after the next one is prefetched
+   while the next one runs. That's slower on the loops it was meant for, see
+   bench/successor_cache.sh, so it's left out by default */
+static inline size_t follow_unchecked_chunk(size_t chunk, unsigned int *tos)
+{
+#ifdef XRF_SUCCESSOR_CACHE
+    if (*tos != successors[chunk]) {
+        if (*tos >= code.num_chunks) {
+            fprintf(stderr, "Error! Cannot go to nonexistent chunk %u!\n",
+                    *tos);
+            exit(1);
+        }
+        successors[chunk] = *tos;
+    }
+    __builtin_prefetch(THREAD_OF(successors[*tos]));
+#else
+    (void) chunk;
+    if (*tos >= code.num_chunks) {
+        fprintf(stderr, "Error! Cannot go to nonexistent chunk %u!\n", *tos);
+        exit(1);
+    }
+#endif
+    return guard_chunk(*tos, tos);
+}
+
+/* Reports going to a chunk past the last one, which is how a variant that
+   steps onto the padding ends */
+static void report_no_chunk(size_t chunk) {
+    fprintf(stderr, "Error! Cannot go to nonexistent chunk %zu!\n", chunk);
+    exit(1);
+}
+
+/* Marks a chunk as visited once its first-visit variant has run unchecked,
+   and returns the guarded chunk that runs next */
+static inline size_t next_unchecked_chunk(size_t chunk, unsigned int *tos) {
+    code.chunks[chunk] |= CHUNK_VISITED;
+    return follow_unchecked_chunk(chunk, tos);
+}
+
+/* Returns the linked revisit code that a variant going back to its own chunk
+   runs next once it's guarded like guard_chunk does. The chunk is known to be
+   on top of the stack, so it doesn't need to be checked or looked up */
+static inline const union Thread *guard_link(const union Thread *link,
+                                             size_t *chunk, unsigned int *tos)
+{
+    if (stack_size < THREAD_GUARD(link).min_depth
+        || stack_size + THREAD_GUARD(link).max_growth > stack.mask + 1)
+    {
+        spill_top(*tos);
+        *chunk = prepare_chunk(*chunk);
+        *tos = STACK_TOP;
+        return THREAD_OF(*chunk);
+    }
+    return link;
+}
+
+#ifdef __GNUC__
+/* The labels of the superinstructions in the computed-goto core, and their
+   code */
+#define GOTO_PAIR_ENTRY(first, second) \
+    pairs[pair++].label = &&pair_##first##_##second;
+
+#define GOTO_PAIR(first, second)       \
+    pair_##first##_##second:           \
+        tos = SUPER_ACTION_##first;    \
+        tos = SUPER_ACTION_##second;   \
+        goto *(ip++)->label;
+
+/* Runs the program with a direct-threaded core, where every op jumps straight
+   to the label of the op after it. Chunks are guarded on entry, so the ops
+   run unchecked, and the top of the stack is kept in tos between them */
+void run_goto_engine() {
+    static union Thread table[NUM_OPS];
+    static union Thread pairs[NUM_SUPER_OPS * NUM_SUPER_OPS];
+    const union Thread *ip;
+    size_t chunk;
+    unsigned int tos;
+    unsigned pair = 0;
+
+    table[OP_INPUT].label = &&input;
+    table[OP_OUTPUT].label = &&output;
+    table[OP_POP].label = &&pop;
+    table[OP_DUP].label = &&dup;
+    table[OP_SWAP].label = &&swap;
+    table[OP_INC].label = &&inc;
+    table[OP_DEC].label = &&dec;
+    table[OP_ADD].label = &&add;
+    table[OP_BOTTOM].label = &&bottom;
+    table[OP_EXIT].label = &&exit_program;
+    table[OP_RANDOMIZE].label = &&randomize;
+    table[OP_SUB].label = &&sub;
+    table[OP_NEXT_CHUNK].label = &&next;
+    table[OP_NEXT_REVISIT].label = &&next_revisit;
+    table[OP_REPEAT_CHUNK].label = &&repeat;
+    table[OP_REPEAT_REVISIT].label = &&repeat_revisit;
+    table[OP_LINK_CHUNK].label = &&link;
+    table[OP_LINK_REVISIT].label = &&link_revisit;
+    table[OP_INC_N].label = &&inc_n;
+    table[OP_DEC_N].label = &&dec_n;
+    table[OP_POP_N].label = &&pop_n;
+    table[OP_SUPER].label = &&super;
+    table[OP_BLOCK].label = &&block;
+    table[OP_STEP_CHUNK].label = &&step;
+    table[OP_STEP_REVISIT].label = &&step_revisit;
+    table[OP_NO_CHUNK].label = &&no_chunk;
+    SUPER_PAIRS(GOTO_PAIR_ENTRY)
+
+    chunk = warm_up_threads(table, pairs);
+    tos = STACK_TOP;
+    chunk = guard_chunk(chunk, &tos);
+    ip = THREAD_OF(chunk);
+    goto *(ip++)->label;
+
+    SUPER_PAIRS(GOTO_PAIR)
+
+input:
+    tos = input_cached(tos);
+    goto *(ip++)->label;
+output:
+    tos = output_cached(tos);
+    goto *(ip++)->label;
+pop:
+    tos = pop_cached();
+    goto *(ip++)->label;
+dup:
+    tos = dup_cached(tos);
+    goto *(ip++)->label;
+swap:
+    tos = swap_cached(tos);
+    goto *(ip++)->label;
+inc:
+    tos++;
+    goto *(ip++)->label;
+dec:
+    tos = dec_cached(tos);
+    goto *(ip++)->label;
+add:
+    tos = add_cached(tos);
+    goto *(ip++)->label;
+bottom:
+    tos = bottom_cached(tos);
+    goto *(ip++)->label;
+exit_program:
+    exit(0);
+randomize:
+    tos = randomize_cached(tos);
+    goto *(ip++)->label;
+sub:
+    tos = sub_cached(tos);
+    goto *(ip++)->label;
+inc_n:
+    tos += (ip++)->count;
+    goto *(ip++)->label;
+dec_n:
+    tos = dec_n_cached(tos, (ip++)->count);
+    goto *(ip++)->label;
+pop_n:
+    tos = drop_cached((ip++)->count);
+    goto *(ip++)->label;
+super:
+    tos = (ip++)->super(tos);
+    goto *(ip++)->label;
+next:
+    chunk = next_unchecked_chunk(chunk, &tos);
+    ip = THREAD_OF(chunk);
+    goto *(ip++)->label;
+next_revisit:
+    chunk = follow_unchecked_chunk(chunk, &tos);
+    ip = THREAD_OF(chunk);
+    goto *(ip++)->label;
+repeat:
+    code.chunks[chunk] |= CHUNK_VISITED;
+repeat_revisit:
+    ip = guard_link(ip->link, &chunk, &tos);
+    goto *(ip++)->label;
+link:
+    code.chunks[chunk] |= CHUNK_VISITED;
+link_revisit:
+    chunk = guard_chunk(ip->chunk, &tos);
+    ip = THREAD_OF(chunk);
+    goto *(ip++)->label;
+block:
+    ip = ip->link;
+    goto *(ip++)->label;
+step:
+    code.chunks[chunk] |= CHUNK_VISITED;
+step_revisit:
+    chunk = guard_chunk(chunk + ip->count, &tos);
+    ip = THREAD_OF(chunk);
+    goto *(ip++)->label;
+no_chunk:
+    report_no_chunk(chunk);
+}
+#endif
+
+/* The handlers of the tail-call threaded core. Each one runs its op and then
+   calls the handler of the next op in tail position, which the compiler turns
+   into a jump when optimizing. Like in the computed-goto core, chunks are
+   guarded on entry, the ops run unchecked, and the top of the stack is passed
+   along as tos */
+#define TAIL_HANDLER(name, action)                                        \
+    void tail_##name(const union Thread *ip, size_t chunk, unsigned int tos) { \
+        tos = action;                                                     \
+        ip[1].handler(ip + 1, chunk, tos);                                \
+    }
+
+TAIL_HANDLER(input, input_cached(tos))
+TAIL_HANDLER(output, output_cached(tos))
+TAIL_HANDLER(pop, pop_cached())
+TAIL_HANDLER(dup, dup_cached(tos))
+TAIL_HANDLER(swap, swap_cached(tos))
+TAIL_HANDLER(inc, tos + 1)
+TAIL_HANDLER(dec, dec_cached(tos))
+TAIL_HANDLER(add, add_cached(tos))
+TAIL_HANDLER(bottom, bottom_cached(tos))
+TAIL_HANDLER(randomize, randomize_cached(tos))
+TAIL_HANDLER(sub, sub_cached(tos))
+
+/* The handlers of runs of ops, which skip over the slot holding the count */
+#define TAIL_RUN_HANDLER(name, action)                                    \
+    void tail_##name(const union Thread *ip, size_t chunk, unsigned int tos) { \
+        unsigned int n = ip[1].count;                                     \
+                                                                          \
+        tos = action;                                                     \
+        ip[2].handler(ip + 2, chunk, tos);                                \
+    }
+
+TAIL_RUN_HANDLER(inc_n, tos + n)
+TAIL_RUN_HANDLER(dec_n, dec_n_cached(tos, n))
+TAIL_RUN_HANDLER(pop_n, drop_cached(n))
+
+void tail_super(const union Thread *ip, size_t chunk, unsigned int tos) {
+    tos = ip[1].super(tos);
+    ip[2].handler(ip + 2, chunk, tos);
+}
+
+/* The handlers of the superinstructions */
+#define TAIL_PAIR(first, second)                                          \
+    TAIL_HANDLER(pair_##first##_##second,                                 \
+                 (tos = SUPER_ACTION_##first, SUPER_ACTION_##second))
+
+#define TAIL_PAIR_ENTRY(first, second) \
+    pairs[pair++].handler = tail_pair_##first##_##second;
+
+SUPER_PAIRS(TAIL_PAIR)
+
+void tail_exit(const union Thread *ip, size_t chunk, unsigned int tos) {
+    (void) ip;
+    (void) chunk;
+    (void) tos;
+    exit(0);
+}
+
+void tail_next(const union Thread *ip, size_t chunk, unsigned int tos) {
+    chunk = next_unchecked_chunk(chunk, &tos);
+    ip = THREAD_OF(chunk);
+    ip->handler(ip, chunk, tos);
+}
+
+void tail_next_revisit(const union Thread *ip, size_t chunk, unsigned int tos)
+{
+    chunk = follow_unchecked_chunk(chunk, &tos);
+    ip = THREAD_OF(chunk);
+    ip->handler(ip, chunk, tos);
+}
+
+void tail_repeat_revisit(const union Thread *ip, size_t chunk,
+                         unsigned int tos)
+{
+    ip = guard_link(ip[1].link, &chunk, &tos);
+    ip->handler(ip, chunk, tos);
+}
+
+void tail_repeat(const union Thread *ip, size_t chunk, unsigned int tos) {
+    code.chunks[chunk] |= CHUNK_VISITED;
+    tail_repeat_revisit(ip, chunk, tos);
+}
+
+void tail_link_revisit(const union Thread *ip, size_t chunk, unsigned int tos)
+{
+    chunk = guard_chunk(ip[1].chunk, &tos);
+    ip = THREAD_OF(chunk);
+    ip->handler(ip, chunk, tos);
+}
+
+void tail_link(const union Thread *ip, size_t chunk, unsigned int tos) {
+    code.chunks[chunk] |= CHUNK_VISITED;
+    tail_link_revisit(ip, chunk, tos);
+}
+
+void tail_block(const union Thread *ip, size_t chunk, unsigned int tos) {
+    ip = ip[1].link;
+    ip->handler(ip, chunk, tos);
+}
+
+void tail_step_revisit(const union Thread *ip, size_t chunk, unsigned int tos)
+{
+    chunk = guard_chunk(chunk + ip[1].count, &tos);
+    ip = THREAD_OF(chunk);
+    ip->handler(ip, chunk, tos);
+}
+
+void tail_step(const union Thread *ip, size_t chunk, unsigned int tos) {
+    code.chunks[chunk] |= CHUNK_VISITED;
+    tail_step_revisit(ip, chunk, tos);
+}
+
+void tail_no_chunk(const union Thread *ip, size_t chunk, unsigned int tos) {
+    (void) ip;
+    (void) tos;
+    report_no_chunk(chunk);
+}
+
+/* Runs the program with a tail-call threaded core, which passes the top of
+   the stack from handler to handler */
+void run_tail_engine() {
+    static union Thread table[NUM_OPS];
+    static union Thread pairs[NUM_SUPER_OPS * NUM_SUPER_OPS];
+    const union Thread *ip;
+    size_t chunk;
+    unsigned int tos;
+    unsigned pair = 0;
+
+    table[OP_INPUT].handler = tail_input;
+    table[OP_OUTPUT].handler = tail_output;
+    table[OP_POP].handler = tail_pop;
+    table[OP_DUP].handler = tail_dup;
+    table[OP_SWAP].handler = tail_swap;
+    table[OP_INC].handler = tail_inc;
+    table[OP_DEC].handler = tail_dec;
+    table[OP_ADD].handler = tail_add;
+    table[OP_BOTTOM].handler = tail_bottom;
+    table[OP_EXIT].handler = tail_exit;
+    table[OP_RANDOMIZE].handler = tail_randomize;
+    table[OP_SUB].handler = tail_sub;
+    table[OP_NEXT_CHUNK].handler = tail_next;
+    table[OP_NEXT_REVISIT].handler = tail_next_revisit;
+    table[OP_REPEAT_CHUNK].handler = tail_repeat;
+    table[OP_REPEAT_REVISIT].handler = tail_repeat_revisit;
+    table[OP_LINK_CHUNK].handler = tail_link;
+    table[OP_LINK_REVISIT].handler = tail_link_revisit;
+    table[OP_INC_N].handler = tail_inc_n;
+    table[OP_DEC_N].handler = tail_dec_n;
+    table[OP_POP_N].handler = tail_pop_n;
+    table[OP_SUPER].handler = tail_super;
+    table[OP_BLOCK].handler = tail_block;
+    table[OP_STEP_CHUNK].handler = tail_step;
+    table[OP_STEP_REVISIT].handler = tail_step_revisit;
+    table[OP_NO_CHUNK].handler = tail_no_chunk;
+    SUPER_PAIRS(TAIL_PAIR_ENTRY)
+
+    chunk = warm_up_threads(table, pairs);
+    tos = STACK_TOP;
+    chunk = guard_chunk(chunk, &tos);
+    ip = THREAD_OF(chunk);
+    ip->handler(ip, chunk, tos);
+}
+
+/* Executes the stored XRF code with the given core */
+void execute_code(enum Engine engine) {
+    init_stack();
+    atexit(free_stack);
+
+    if (engine != ENGINE_STREAM && code.num_chunks == 0) {
+        fprintf(stderr, "Error! Cannot go to nonexistent chunk 0!\n");
+        exit(1);
+    }
+
+#ifdef XRF_HAVE_JIT
+    /* This only returns if the program couldn't be compiled, in which case
+       the default core runs it instead */
+    if (engine == ENGINE_JIT) {
+        run_jit_engine();
+        engine = DEFAULT_ENGINE;
+    }
+#endif
+#ifdef XRF_HAVE_NATIVE
+    /* Likewise, this only returns if the program couldn't be compiled */
+    if (engine == ENGINE_NATIVE) {
+        run_native_engine();
+        engine = DEFAULT_ENGINE;
+    }
+#endif
+
+    switch (engine) {
+        case ENGINE_SWITCH:
+            run_switch_engine();
+            break;
+#ifdef __GNUC__
+        case ENGINE_GOTO:
+            run_goto_engine();
+            break;
+#endif
+        case ENGINE_TAIL:
+            run_tail_engine();
+            break;
+        case ENGINE_STREAM:
+            run_stream_engine();
+            break;
+        default:
+            break;
+    }
+}
+
+/* Returns the engine with the given name, exiting if there isn't one */
+enum Engine parse_engine(const char *name) {
+    unsigned i;
+
+    for (i = 0; i < sizeof(ENGINE_NAMES) / sizeof(*ENGINE_NAMES); i++) {
+        if (ENGINE_NAMES[i] != NULL && strcmp(name, ENGINE_NAMES[i]) == 0) {
+            return i;
+        }
+    }
+    fprintf(stderr, "Error! Unknown engine %s!\n", name);
+    exit(1);
+}
+
+/* Writes the program out as C to output_name, or to stdout if it's NULL */
+void write_c_file(const char *filename, const char *output_name) {
+    FILE *out = output_name != NULL ? fopen(output_name, "w") : stdout;
+
+    if (out == NULL) {
+        fprintf(stderr, "Error! Unable to open %s!\n", output_name);
+        exit(1);
+    }
+    emit_c(out, filename, "main");
+    if ((output_name != NULL ? fclose(out) : fflush(out)) != 0) {
+        fprintf(stderr, "Error! Unable to write the C program!\n");
+        exit(1);
+    }
+}
+
+int main(int argc, char **argv) {
+    enum Engine engine = DEFAULT_ENGINE;
+    enum FlushPolicy policy = FLUSH_DEFAULT;
+    const char *filename = NULL, *output_name = NULL;
+    const char **files = malloc(sizeof(const char *) * argc);
+    bool translate = false, compile = false, streamed = false;
+    bool generate = false;
+    size_t num_files = 0;
+    int i;
+
+    if (files == NULL) {
+        fprintf(stderr, "Error! Unable to allocate space for the "
+                        "arguments!\n");
+        exit(1);
+    }
+
+    for (i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--engine=", 9) == 0) {
+            engine = parse_engine(argv[i] + 9);
+        } else if (strncmp(argv[i], "--flush=", 8) == 0) {
+            if (!parse_flush_policy(argv[i] + 8, &policy)) {
+                fprintf(stderr, "Error! Unknown flush policy %s!\n",
+                        argv[i] + 8);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--emit-c") == 0) {
+            translate = true;
+        } else if (strcmp(argv[i], "--compile") == 0) {
+            compile = true;
+        } else if (strcmp(argv[i], "--stream") == 0) {
+            streamed = true;
+        } else if (strcmp(argv[i], "--superinstructions") == 0) {
+            generate = true;
+        } else if (strcmp(argv[i], "-o") == 0) {
+            if (++i == argc) {
+                fprintf(stderr, "Error! No output filename given!\n");
+                exit(1);
+            }
+            output_name = argv[i];
+        } else if (strncmp(argv[i], "-", 1) == 0) {
+            fprintf(stderr, "Error! Unknown option %s!\n", argv[i]);
+            exit(1);
+        } else {
+            files[num_files++] = argv[i];
+            filename = filename != NULL ? filename : argv[i];
+        }
+    }
+    if (filename == NULL) {
+        fprintf(stderr, "Error! No filename given!");
+        exit(1);
+    }
+    /* Output is set up before anything can run, since the native engine
+       buffers the output of cached code the same way */
+    init_output(policy);
+    if (translate + compile + streamed + generate > 1) {
+        fprintf(stderr, "Error! Only one of --emit-c, --compile, --stream and "
+                        "--superinstructions can be given!\n");
+        exit(1);
+    } else if (generate) {
+        write_superinstructions(files, num_files, output_name);
+        free(files);
+        return 0;
+    } else if (streamed) {
+        start_stream(filename);
+        engine = ENGINE_STREAM;
+    } else {
+#ifdef XRF_HAVE_NATIVE
+        /* A program that was compiled before runs without being loaded */
+        if (engine == ENGINE_NATIVE && !translate && !compile) {
+            run_cached_program(filename);
+        }
+#endif
+        read_xrf_file(filename);
+    }
+    free(files);
+    if (translate) {
+        write_c_file(filename, output_name);
+        return 0;
+    } else if (compile) {
+        write_image(output_name);
+        return 0;
+    }
+    srand(time(NULL));
+    init_input();
+    execute_code(engine);
+    return 0;
+}
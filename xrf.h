@@ -0,0 +1,628 @@
+#ifndef XRF_H
+#define XRF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define COMMANDS_PER_CHUNK 5
+
+/* A growable ring buffer holding the stack. The top of the stack is at index
+   head, and the values below it follow at increasing indices, wrapping around
+   the end of the array, so the bottom of the stack sits just before the
+   free space that push_stack grows into */
+struct Stack {
+    unsigned int *vals; /* Circular array of stack values */
+    size_t head; /* Index of the top of the stack */
+    size_t mask; /* Capacity of vals minus one, the capacity is a power of 2 */
+};
+
+extern struct Stack stack;
+extern size_t stack_size;
+
+/* The value on top of the stack, and the value i nodes below the top */
+#define STACK_TOP (stack.vals[stack.head])
+#define STACK_AT(i) (stack.vals[(stack.head + (i)) & stack.mask])
+
+/* The numeric opcodes of the XRF commands, which are the values of their hex
+   digits */
+enum Opcode {
+    OP_INPUT,           /* 0: Pushes a character read from stdin */
+    OP_OUTPUT,          /* 1: Pops and outputs the top of the stack */
+    OP_POP,             /* 2: Pops the top of the stack */
+    OP_DUP,             /* 3: Duplicates the top of the stack */
+    OP_SWAP,            /* 4: Swaps the top two values of the stack */
+    OP_INC,             /* 5: Increments the top of the stack */
+    OP_DEC,             /* 6: Decrements the top of the stack */
+    OP_ADD,             /* 7: Adds the top two values of the stack */
+    OP_SKIP_UNVISITED,  /* 8: Skips the next command on a first visit */
+    OP_BOTTOM,          /* 9: Sends the top of the stack to the bottom */
+    OP_END_CHUNK,       /* A: Ends the current chunk */
+    OP_EXIT,            /* B: Ends the program */
+    OP_SKIP_VISITED,    /* C: Skips the next command on a revisit */
+    OP_RANDOMIZE,       /* D: Randomizes the order of the stack */
+    OP_SUB,             /* E: Absolute difference of the top two values */
+    OP_NOP,             /* F: Does nothing */
+    OP_NEXT_CHUNK,      /* Not a command, ends a first-visit variant in
+                           threaded code */
+    OP_NEXT_REVISIT,    /* Not a command, ends a revisit variant in threaded
+                           code */
+    OP_REPEAT_CHUNK,    /* Not a command, ends a first-visit variant that
+                           always goes back to its own chunk */
+    OP_REPEAT_REVISIT,  /* Not a command, ends a revisit variant that always
+                           goes back to its own chunk */
+    OP_LINK_CHUNK,      /* Not a command, ends a first-visit variant that
+                           always goes on to the same other chunk */
+    OP_LINK_REVISIT,    /* Not a command, ends a revisit variant that always
+                           goes on to the same other chunk */
+    OP_INC_N,           /* Not a command, a run of increments */
+    OP_DEC_N,           /* Not a command, a run of decrements */
+    OP_POP_N,           /* Not a command, a run of pops */
+    OP_SUPER,           /* Not a command, a generated superinstruction */
+    OP_BLOCK,           /* Not a command, goes on to the superblock that a
+                           chunk's revisit code was fused into */
+    OP_STEP_CHUNK,      /* Not a command, ends a first-visit variant that
+                           always goes the same number of chunks ahead */
+    OP_STEP_REVISIT,    /* Not a command, ends a revisit variant that always
+                           goes the same number of chunks ahead */
+    OP_NO_CHUNK,        /* Not a command, the code of the chunks past the
+                           last one, which reports going to them */
+    NUM_OPS
+};
+
+/* The straight-line sequence of ops a chunk runs on one kind of visit, with
+   its skips already resolved, its no-ops dropped, and nothing kept past an A
+   or B */
+struct Variant {
+    unsigned char ops[COMMANDS_PER_CHUNK]; /* The ops to run, in order */
+    unsigned char len; /* How many ops there are */
+    unsigned char min_depth; /* The fewest values the stack can hold on
+                                entry without an op underflowing, or the
+                                stack ending up empty */
+    signed char net_delta; /* How much the ops change the stack depth */
+    unsigned char max_growth; /* The most the stack grows above its depth
+                                 on entry while the ops run */
+    signed char exit_delta; /* How far past its own chunk the variant always
+                               goes next, or EXIT_DYNAMIC if that depends on
+                               the stack */
+};
+
+/* The exit_delta of a variant whose next chunk isn't known until it runs */
+#define EXIT_DYNAMIC (-1)
+
+/* How many values each op needs on the stack, and how it changes the depth
+   of the stack */
+struct OpEffect {
+    unsigned char needs;
+    signed char delta;
+};
+
+extern const struct OpEffect OP_EFFECTS[NUM_OPS];
+
+/* An op of a variant as lowered for the threaded cores, which runs count
+   times in a row. Only increments, decrements and pops are ever repeated */
+struct FusedOp {
+    unsigned char op;
+    unsigned char count;
+};
+
+/* How many ops superinstructions can be made of, and the position of each
+   among them plus one, or zero for ops that can't be part of one. These are
+   the ops that work on the cached top of the stack without spilling it */
+#define NUM_SUPER_OPS 9
+
+extern const unsigned char SUPER_INDEX[NUM_OPS];
+
+/* A sequence of ops with a handler of its own, generated at build time from
+   a corpus of programs by xrf --superinstructions. The handler runs the ops
+   on the cached top of the stack and returns the new top */
+struct Superinstruction {
+    unsigned char ops[COMMANDS_PER_CHUNK]; /* The ops it stands for */
+    unsigned char len; /* How many ops there are */
+    unsigned int (*run)(unsigned int tos); /* Its handler */
+};
+
+extern const struct Superinstruction SUPERINSTRUCTIONS[];
+extern const size_t NUM_SUPERINSTRUCTIONS;
+
+/* The instructions of the IR that variants are lifted into, which every
+   backend lowers from. Each instruction defines one value, which the
+   instructions after it refer to by its index */
+enum IrOp {
+    IR_LOAD,    /* The value imm down from the top of the stack on entry */
+    IR_CONST,   /* The constant imm */
+    IR_INPUT,   /* A character read from stdin */
+    IR_OUTPUT,  /* Outputs value a */
+    IR_ADD,     /* a + b */
+    IR_ADD_IMM, /* a + imm */
+    IR_SUB_SAT, /* a - imm, stopping at zero */
+    IR_DIFF     /* The difference between a and b */
+};
+
+struct IrInst {
+    unsigned char op;
+    bool live; /* Whether anything needs the instruction to run */
+    unsigned char a, b;
+    unsigned int imm;
+};
+
+/* The most instructions a segment can have, which is one load for each of
+   the two values an op can take off the stack, plus the op */
+#define IR_MAX_INSTS (COMMANDS_PER_CHUNK * 3)
+
+/* A run of the ops of a variant with no op in it that needs the whole
+   stack. Its effect on the stack is that consumed values are taken off the
+   top, and the values in stack are put on in their place */
+struct IrSegment {
+    struct IrInst insts[IR_MAX_INSTS];
+    unsigned char num_insts;
+    unsigned char stack[COMMANDS_PER_CHUNK * 2]; /* The values the segment
+                                                    leaves, bottom first */
+    unsigned char depth; /* How many values that is */
+    unsigned char consumed;
+    unsigned char barrier; /* The op that runs after the segment, which is
+                              OP_BOTTOM, OP_RANDOMIZE or OP_EXIT, or
+                              OP_END_CHUNK for the last segment */
+};
+
+struct IrVariant {
+    struct IrSegment segments[COMMANDS_PER_CHUNK + 1];
+    unsigned num_segments;
+};
+
+/* The body of a chunk is packed into a single word, with the opcode of its
+   ith command in the ith nibble from the bottom. Each chunk of a program is a
+   word holding the index of its body in the table of unique bodies, which
+   fits in the same number of bits, and a bit above them for whether the chunk
+   has been visited yet */
+#define CHUNK_VISITED ((uint32_t) 1 << (4 * COMMANDS_PER_CHUNK))
+#define CHUNK_OP(body, i) (((body) >> (4 * (i))) & 0xF)
+#define CHUNK_IS_VISITED(chunk) (((chunk) & CHUNK_VISITED) != 0)
+#define CHUNK_UNIQUE(chunk) ((chunk) & (CHUNK_VISITED - 1))
+#define CHUNK_BODY(chunk) (code.bodies[CHUNK_UNIQUE(chunk)])
+
+/* How many chunks an array of chunks allocated by the loader has past the
+   last one, which covers the furthest ahead a variant can always go. They
+   hold the index num_bodies, which no body has, so that the threaded cores
+   can go a fixed number of chunks ahead without checking the index */
+#define CHUNK_PADDING COMMANDS_PER_CHUNK
+
+/* A struct for keeping track of the read-in XRF code */
+struct Code {
+    uint32_t *chunks; /* Array of all the chunks */
+    size_t num_chunks; /* How many chunks there are */
+    uint32_t *bodies; /* The packed bodies the chunks share */
+    size_t num_bodies; /* How many different bodies there are */
+    struct Variant *variants; /* Both variants of each body, indexed by the
+                                 body's index times two plus visited */
+    bool padded; /* Whether chunks has CHUNK_PADDING chunks past the last
+                    one, which it can't when mapped from a compiled program
+                    or when num_bodies doesn't fit below CHUNK_VISITED */
+    void *image; /* The mapping of a compiled program the arrays point
+                    into, or NULL if they were allocated */
+    size_t image_len; /* The length of that mapping */
+};
+
+extern struct Code code;
+
+/* Returns the opcode of the given hex digit, or -1 if it isn't a command */
+static inline int decode_command(int c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/* Picks the fastest way to scan program text that the CPU supports. Must be
+   called before scan_commands */
+void init_scanner();
+
+/* Checks that the text of a program only holds commands and whitespace, and
+   copies its commands into cmds, returning how many there are. Scanning stops
+   at the first byte that's neither, and *bad is set to where it is, or to len
+   if there isn't one. Safe to call from several threads at once */
+size_t scan_commands(const unsigned char *text, size_t len,
+                     unsigned char *cmds, size_t *bad);
+
+/* Exits with the error for a byte that can't appear in a program */
+void report_bad_character(unsigned char c);
+
+void grow_stack();
+void push_stack(unsigned int val);
+unsigned int pop_stack();
+void swap_stack();
+void dup_stack();
+void send_top_to_bottom();
+void randomize_stack();
+
+/* How many bytes of output are buffered before being written */
+#define OUTPUT_BUFFER_SIZE (1 << 16)
+
+/* When buffered output gets written to stdout, besides on exit */
+enum FlushPolicy {
+    FLUSH_LINE,   /* When the buffer fills, or on a newline */
+    FLUSH_FULL,   /* Only when the buffer fills */
+    FLUSH_NONE,   /* After every character */
+    FLUSH_DEFAULT /* FLUSH_LINE if stdout is a terminal, else FLUSH_FULL */
+};
+
+/* The buffer that output is collected in, which is written straight to
+   stdout without going through stdio */
+struct Output {
+    unsigned char buf[OUTPUT_BUFFER_SIZE]; /* The buffered output */
+    size_t len; /* How many bytes are buffered */
+    size_t limit; /* How many bytes can be buffered before flushing */
+    int flush_char; /* Character that flushes the buffer, or -1 */
+};
+
+extern struct Output output;
+
+/* Sets up output with the given policy, flushing it on exit */
+void init_output(enum FlushPolicy policy);
+
+/* Writes out everything that's been buffered */
+void flush_output();
+
+/* Sets policy to the flush policy with the given name, returning false if
+   there isn't one */
+bool parse_flush_policy(const char *name, enum FlushPolicy *policy);
+
+/* Outputs a character */
+static inline void write_output(unsigned char c) {
+    output.buf[output.len++] = c;
+    if (output.len >= output.limit || c == output.flush_char) {
+        flush_output();
+    }
+}
+
+/* How many bytes of input are read at a time when stdin can't be mapped */
+#define INPUT_BUFFER_SIZE (1 << 16)
+
+/* The input waiting to be read. When stdin is a regular file it's mapped
+   whole, and otherwise it's read in blocks into buf */
+struct Input {
+    const unsigned char *pos; /* The next byte of input */
+    const unsigned char *end; /* The end of the available input */
+    unsigned char *buf; /* The buffer input is read into, if not mapped */
+    void *map; /* The mapping of stdin, or NULL */
+    size_t map_len; /* The length of the mapping */
+    bool eof; /* Whether stdin has run out */
+};
+
+extern struct Input input;
+
+/* Sets up reading from stdin */
+void init_input();
+
+/* Reads the next block of input, returning false at the end of input. When
+   output is line-buffered, a pending prompt is flushed first, like stdio
+   does */
+bool refill_input();
+
+/* Reads a character from stdin, or returns EOF */
+static inline int read_input() {
+    if (input.pos == input.end && !refill_input()) {
+        return EOF;
+    }
+    return *input.pos++;
+}
+
+/* Versions of the commands without any checks, for variants whose stack use
+   has already been checked on entry to their chunk */
+static inline void push_unchecked(unsigned int val) {
+    stack.head = (stack.head - 1) & stack.mask;
+    STACK_TOP = val;
+    stack_size++;
+}
+
+static inline unsigned int pop_unchecked() {
+    unsigned int val = STACK_TOP;
+
+    stack.head = (stack.head + 1) & stack.mask;
+    stack_size--;
+    return val;
+}
+
+static inline void input_unchecked() {
+    int c = read_input();
+
+    push_unchecked(c == EOF ? 0 : (unsigned) c);
+}
+
+static inline void output_unchecked() {
+    write_output(pop_unchecked());
+}
+
+static inline void dup_unchecked() {
+    push_unchecked(STACK_TOP);
+}
+
+static inline void swap_unchecked() {
+    unsigned int temp = STACK_TOP;
+
+    STACK_TOP = STACK_AT(1);
+    STACK_AT(1) = temp;
+}
+
+static inline void inc_unchecked() {
+    STACK_TOP += 1;
+}
+
+static inline void dec_unchecked() {
+    if (STACK_TOP > 0)
+        STACK_TOP -= 1;
+}
+
+static inline void add_unchecked() {
+    STACK_AT(1) += STACK_TOP;
+    pop_unchecked();
+}
+
+static inline void sub_unchecked() {
+    unsigned int val = pop_unchecked();
+
+    if (val <= STACK_TOP)
+        STACK_TOP -= val;
+    else
+        STACK_TOP = val - STACK_TOP;
+}
+
+/* Moving the head down leaves the old top just past the bottom, where it's
+   stored again, which also works out for a one-value stack */
+static inline void bottom_unchecked() {
+    unsigned int val = STACK_TOP;
+
+    stack.head = (stack.head + 1) & stack.mask;
+    STACK_AT(stack_size - 1) = val;
+}
+
+/* Versions of the unchecked commands for cores that keep the top of the
+   stack in a local variable, which the compiler can keep in a register. Each
+   takes the cached top and returns the new one. The cell the top belongs in
+   is left stale, and only written when a push moves the top down into the
+   stack, or with spill_top before the stack is used as a whole */
+static inline void spill_top(unsigned int tos) {
+    STACK_TOP = tos;
+}
+
+static inline unsigned int push_cached(unsigned int tos, unsigned int val) {
+    STACK_TOP = tos;
+    stack.head = (stack.head - 1) & stack.mask;
+    stack_size++;
+    return val;
+}
+
+/* Drops the cached top, returning the value below it */
+static inline unsigned int pop_cached() {
+    stack.head = (stack.head + 1) & stack.mask;
+    stack_size--;
+    return STACK_TOP;
+}
+
+/* Drops the cached top and the n - 1 values below it */
+static inline unsigned int drop_cached(unsigned int n) {
+    stack.head = (stack.head + n) & stack.mask;
+    stack_size -= n;
+    return STACK_TOP;
+}
+
+static inline unsigned int input_cached(unsigned int tos) {
+    int c = read_input();
+
+    return push_cached(tos, c == EOF ? 0 : (unsigned) c);
+}
+
+static inline unsigned int output_cached(unsigned int tos) {
+    write_output(tos);
+    return pop_cached();
+}
+
+static inline unsigned int dup_cached(unsigned int tos) {
+    return push_cached(tos, tos);
+}
+
+static inline unsigned int swap_cached(unsigned int tos) {
+    unsigned int second = STACK_AT(1);
+
+    STACK_AT(1) = tos;
+    return second;
+}
+
+static inline unsigned int dec_cached(unsigned int tos) {
+    return tos > 0 ? tos - 1 : 0;
+}
+
+/* Decrements the top n times, stopping at zero */
+static inline unsigned int dec_n_cached(unsigned int tos, unsigned int n) {
+    return tos > n ? tos - n : 0;
+}
+
+static inline unsigned int add_cached(unsigned int tos) {
+    return pop_cached() + tos;
+}
+
+static inline unsigned int sub_cached(unsigned int tos) {
+    unsigned int second = pop_cached();
+
+    return tos <= second ? second - tos : tos - second;
+}
+
+static inline unsigned int bottom_cached(unsigned int tos) {
+    spill_top(tos);
+    bottom_unchecked();
+    return STACK_TOP;
+}
+
+static inline unsigned int randomize_cached(unsigned int tos) {
+    spill_top(tos);
+    randomize_stack();
+    return STACK_TOP;
+}
+
+/* Pushes a character read from stdin, or 0 on EOF */
+static inline void op_input() {
+    int c = read_input();
+
+    push_stack(c == EOF ? 0 : (unsigned) c);
+}
+
+/* Pops the top of the stack and outputs it */
+static inline void op_output() {
+    if (stack_size == 0) {
+        fprintf(stderr, "Error! Cannot output nonexistent value!\n");
+        exit(1);
+    }
+    write_output(pop_stack());
+}
+
+/* Increments the top of the stack */
+static inline void op_inc() {
+    if (stack_size == 0) {
+        fprintf(stderr, "Error! Cannot increment nonexistent value!\n");
+        exit(1);
+    }
+    inc_unchecked();
+}
+
+/* Decrements the top of the stack, stopping at zero */
+static inline void op_dec() {
+    if (stack_size == 0) {
+        fprintf(stderr, "Error! Cannot decrement nonexistent value!\n");
+        exit(1);
+    }
+    dec_unchecked();
+}
+
+/* Replaces the top two values of the stack with their sum */
+static inline void op_add() {
+    if (stack_size < 2) {
+        fprintf(stderr, "Error! Cannot add the top values of a%s\n",
+                stack_size ? " one-value stack.": "n empty stack.");
+        exit(1);
+    }
+    add_unchecked();
+}
+
+/* Replaces the top two values of the stack with their absolute difference */
+static inline void op_sub() {
+    if (stack_size < 2) {
+        fprintf(stderr, "Error! Cannot get the difference of the"
+                        " top two values of a%s!\n",
+                stack_size ? " one-value stack": "n empty stack");
+        exit(1);
+    }
+    sub_unchecked();
+}
+
+/* Returns the chunk that the top of the stack points to once a chunk has
+   run */
+static inline uint32_t *follow_chunk() {
+    if (stack_size == 0) {
+        fprintf(stderr, "Error! Can't have an empty stack upon reaching "
+                        "the end of a chunk!\n");
+        exit(1);
+    }
+    if (STACK_TOP >= code.num_chunks) {
+        fprintf(stderr, "Error! Cannot go to nonexistent chunk %u!\n",
+                STACK_TOP);
+        exit(1);
+    }
+    return &code.chunks[STACK_TOP];
+}
+
+/* Marks a chunk as visited once it has run, and returns the chunk that the
+   top of the stack then points to */
+static inline uint32_t *next_chunk(uint32_t *chunk) {
+    *chunk |= CHUNK_VISITED;
+    return follow_chunk();
+}
+
+/* Marks a body that more than one chunk has in the array returned by
+   find_sole_chunks */
+#define SHARED_BODY SIZE_MAX
+
+/* Returns a malloc'd array of the one chunk that has each unique body, or
+   SHARED_BODY. The chunk a variant always goes to next is only known outright
+   for the variants of these bodies */
+size_t *find_sole_chunks();
+
+uint32_t pack_chunk(const unsigned char *cmds);
+void analyze_variant(struct Variant *variant);
+void compile_variant(struct Variant *variant, uint32_t body, bool visited);
+void execute_chunk(uint32_t body, bool visited);
+void execute_variant(const struct Variant *variant);
+void lift_variant(const struct Variant *variant, struct IrVariant *ir);
+bool ir_in_place(const struct IrSegment *seg, unsigned i);
+bool ir_same_effect(const struct IrVariant *a, const struct IrVariant *b);
+unsigned lower_variant(const struct Variant *variant, struct FusedOp *fused);
+void reserve_stack(size_t n);
+
+/* Writes C source for superinstructions for the sequences of ops that are
+   most common in the given programs */
+void write_superinstructions(const char **files, size_t num_files,
+                             const char *output_name);
+
+/* Writes the loaded program out as a standalone C program, with its code in
+   a function called entry */
+void emit_c(FILE *out, const char *source_name, const char *entry);
+
+/* The runtime every translated program starts with, one line at a time */
+extern const char *const C_RUNTIME[];
+extern const size_t NUM_C_RUNTIME_LINES;
+
+/* Loads the commands of a program's text into chunks, splitting the text
+   into the given number of ranges that are loaded on threads of their own */
+void load_program(const unsigned char *text, size_t len,
+                  unsigned char *cmds, size_t num_ranges);
+void read_xrf_file(const char *filename);
+void free_xrf_code();
+
+#define CHECKSUM_BASIS 0xCBF29CE484222325ULL
+
+/* Folds a run of bytes into a 64-bit hash, starting from CHECKSUM_BASIS */
+uint64_t checksum(uint64_t hash, const void *data, size_t len);
+
+/* Loads a program compiled with --compile from fd, returning false if it
+   isn't one. A compiled program is mapped straight into memory, and only its
+   header and checksum are checked */
+bool load_image(int fd, const char *filename);
+
+/* Writes the loaded program out compiled to output_name, or to stdout if
+   it's NULL */
+void write_image(const char *output_name);
+
+/* Starts reading a program on a background thread, to be run by
+   run_stream_engine as its chunks arrive */
+void start_stream(const char *filename);
+void run_stream_engine();
+
+/* The JIT compiler is only available where it can emit x86-64 code into
+   mmap'd memory */
+#if defined(__x86_64__) && defined(__unix__)
+#define XRF_HAVE_JIT
+
+/* Runs the program as native code, returning false without running anything
+   if the code couldn't be compiled */
+bool run_jit_engine();
+#endif
+
+/* Programs can be compiled to shared objects with the system's C compiler
+   and cached, wherever they can be loaded with dlopen */
+#ifdef __unix__
+#define XRF_HAVE_NATIVE
+
+/* Runs the cached native code of the program in the given file, returning
+   without running anything if there isn't any */
+void run_cached_program(const char *filename);
+
+/* Compiles the loaded program to native code, caches it and runs it, after
+   run_cached_program found nothing. Returns without running anything if the
+   program couldn't be compiled */
+void run_native_engine();
+#endif
+
+#endif